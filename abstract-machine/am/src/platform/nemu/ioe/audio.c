@@ -8,19 +8,47 @@
 #define AUDIO_INIT_ADDR      (AUDIO_ADDR + 0x10)
 #define AUDIO_COUNT_ADDR     (AUDIO_ADDR + 0x14)
 
+// the position in the stream buffer to write the next byte,
+// which is reset with the stream when the device is initialized
+static uint32_t sbuf_pos = 0;
+
 void __am_audio_init() {
 }
 
 void __am_audio_config(AM_AUDIO_CONFIG_T *cfg) {
-  cfg->present = false;
+  cfg->present = true;
+  cfg->bufsize = inl(AUDIO_SBUF_SIZE_ADDR);
 }
 
 void __am_audio_ctrl(AM_AUDIO_CTRL_T *ctrl) {
+  outl(AUDIO_FREQ_ADDR, ctrl->freq);
+  outl(AUDIO_CHANNELS_ADDR, ctrl->channels);
+  outl(AUDIO_SAMPLES_ADDR, ctrl->samples);
+  outl(AUDIO_INIT_ADDR, 1);
+  sbuf_pos = 0;
 }
 
 void __am_audio_status(AM_AUDIO_STATUS_T *stat) {
-  stat->count = 0;
+  stat->count = inl(AUDIO_COUNT_ADDR);
 }
 
 void __am_audio_play(AM_AUDIO_PLAY_T *ctl) {
+  uint8_t *buf = ctl->buf.start;
+  uint32_t len = (uint8_t *)ctl->buf.end - buf;
+  uint32_t size = inl(AUDIO_SBUF_SIZE_ADDR);
+  while (len > 0) {
+    // wait until there is free space in the stream buffer
+    uint32_t count = inl(AUDIO_COUNT_ADDR);
+    uint32_t n = size - count;
+    if (n == 0) continue;
+    if (n > len) n = len;
+    for (uint32_t i = 0; i < n; i ++) {
+      outb(AUDIO_SBUF_ADDR + sbuf_pos, buf[i]);
+      if (++ sbuf_pos == size) sbuf_pos = 0;
+    }
+    // the device adds the bytes written since the count is read
+    outl(AUDIO_COUNT_ADDR, count + n);
+    buf += n;
+    len -= n;
+  }
 }
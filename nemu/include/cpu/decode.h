@@ -22,7 +22,15 @@ typedef struct Decode {
   vaddr_t pc;
   vaddr_t snpc; // static next pc
   vaddr_t dnpc; // dynamic next pc
+  void (*EHelper)(struct Decode *); // execution helper selected by the decoder
+  IFDEF(CONFIG_THREADED_CODE, const void *handler); // label of the helper in threaded code
   ISADecodeInfo isa;
+#ifdef CONFIG_INST_FUSION
+  // helper which executes this instruction and the next one at once,
+  // and the decoding result of the next instruction
+  void (*FHelper)(struct Decode *);
+  ISADecodeInfo fused_isa;
+#endif
   IFDEF(CONFIG_ITRACE, char logbuf[128]);
 } Decode;
 
@@ -99,4 +107,55 @@ finish:
 #define INSTPAT_START(name) { const void ** __instpat_end = &&concat(__instpat_end_, name);
 #define INSTPAT_END(name)   concat(__instpat_end_, name): ; }
 
+// --- decode cache ---
+#ifdef CONFIG_DECODE_CACHE
+#define NR_DCACHE CONFIG_DECODE_CACHE_SIZE
+#define DCACHE_IDX(pc) (((pc) >> 2) & (NR_DCACHE - 1))
+
+extern Decode g_dcache[NR_DCACHE];
+Decode* decode_cache_fill(Decode *s, vaddr_t pc);
+
+// the hit path is inlined into the execute loops
+static inline Decode* decode_cache_lookup(vaddr_t pc) {
+  Decode *s = &g_dcache[DCACHE_IDX(pc)];
+  if (likely(s->pc == pc && s->EHelper != NULL)) return s;
+  return decode_cache_fill(s, pc);
+}
+void decode_cache_invalidate(paddr_t addr, int len);
+void decode_cache_flush();
+#else
+static inline void decode_cache_invalidate(paddr_t addr, int len) {}
+static inline void decode_cache_flush() {}
+#endif
+
+// --- basic block cache ---
+#ifdef CONFIG_BLOCK_CACHE
+typedef struct Block {
+  vaddr_t pc;
+  int nr_inst;
+  Decode *inst;
+  uint32_t gen;
+  // chained successors
+  vaddr_t succ_pc[2];
+  struct Block *succ[2];
+  struct Block *hnext;
+#ifdef CONFIG_ENGINE_JIT
+  uint32_t nr_exec;
+  // compiled code, which returns the number of executed instructions
+  int (*jit)(void);
+#endif
+} Block;
+
+extern uint32_t g_block_gen;
+
+Block* block_cache_next(Block *b, vaddr_t pc);
+void block_cache_invalidate(paddr_t addr, int len);
+void block_cache_flush();
+void block_cache_jit(Block *b);
+const uint8_t* block_cache_code_page();
+#else
+static inline void block_cache_invalidate(paddr_t addr, int len) {}
+static inline void block_cache_flush() {}
+#endif
+
 #endif
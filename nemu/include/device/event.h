@@ -0,0 +1,47 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_EVENT_H__
+#define __DEVICE_EVENT_H__
+
+#include <common.h>
+
+#define TIMER_HZ 60
+
+typedef void (*event_handler_t) ();
+// Call `handler` every `period` us.
+void add_event(const char *name, uint64_t period, event_handler_t handler);
+void event_run();
+
+extern uint64_t g_nr_guest_inst;
+// number of guest instructions at which the next event may be due
+extern uint64_t g_event_inst;
+
+// This is called by the CPU after executing instructions. The host time
+// is only read when the instruction count reaches the next checkpoint.
+static inline void device_update() {
+  if (unlikely(g_nr_guest_inst >= g_event_inst)) event_run();
+}
+
+// print the statistics of devices when the guest halts
+void device_statistic();
+
+// Return how many of `n` instructions can be executed before the next checkpoint.
+static inline uint64_t event_clamp(uint64_t n) {
+  uint64_t left = g_event_inst - g_nr_guest_inst;
+  return (g_event_inst > g_nr_guest_inst && left < n ? left : n);
+}
+
+#endif
@@ -17,6 +17,7 @@
 #define __DEVICE_MAP_H__
 
 #include <cpu/difftest.h>
+#include <memory/vaddr.h>
 
 typedef void(*io_callback_t)(uint32_t, int, bool);
 uint8_t* new_space(int size);
@@ -28,21 +29,45 @@ typedef struct {
   paddr_t high;
   void *space;
   io_callback_t callback;
+  // a map without callback behaves like plain memory, and it records
+  // which of its pages are written, one flag per page
+  uint8_t *dirty;
 } IOMap;
 
-static inline bool map_inside(IOMap *map, paddr_t addr) {
-  return (addr >= map->low && addr <= map->high);
+static inline uint8_t* map_dirty_flag(IOMap *map, paddr_t addr) {
+  return &map->dirty[((addr - (map->low & ~PAGE_MASK)) >> PAGE_SHIFT)];
 }
 
-static inline int find_mapid_by_addr(IOMap *maps, int size, paddr_t addr) {
-  int i;
-  for (i = 0; i < size; i ++) {
-    if (map_inside(maps + i, addr)) {
-      difftest_skip_ref();
-      return i;
-    }
-  }
-  return -1;
+// The address space of MMIO or port-IO is looked up by pages with a
+// two-level table. A page covered by a single map points to it directly,
+// while a page shared by several maps, or partially covered, has a table
+// with the map of every byte.
+#define IO_DIR_SHIFT 22
+#define IO_NR_DIR (1 << (32 - IO_DIR_SHIFT))
+#define IO_NR_DIR_PAGE (1 << (IO_DIR_SHIFT - PAGE_SHIFT))
+
+typedef struct {
+  IOMap *map;
+  IOMap **sub;
+} IOPage;
+
+typedef struct {
+  const char *name;
+  IOPage *dir[IO_NR_DIR];
+} IOTable;
+
+void io_table_add(IOTable *t, const char *name, paddr_t addr,
+        void *space, uint32_t len, io_callback_t callback);
+
+static inline IOMap* io_table_find(IOTable *t, paddr_t addr) {
+#ifdef PMEM64
+  if (addr >> 32) return NULL;
+#endif
+  IOPage *dir = t->dir[(uint32_t)addr >> IO_DIR_SHIFT];
+  if (dir == NULL) return NULL;
+  IOPage *p = &dir[(addr >> PAGE_SHIFT) & (IO_NR_DIR_PAGE - 1)];
+  if (likely(p->map != NULL)) return p->map;
+  return (p->sub == NULL ? NULL : p->sub[addr & PAGE_MASK]);
 }
 
 void add_pio_map(const char *name, ioaddr_t addr,
@@ -50,6 +75,14 @@ void add_pio_map(const char *name, ioaddr_t addr,
 void add_mmio_map(const char *name, paddr_t addr,
         void *space, uint32_t len, io_callback_t callback);
 
+/* return whether any page of a callback-free region in [addr, addr + len)
+ * is written since the last call, and clear the dirty flags of them */
+bool mmio_fetch_dirty(paddr_t addr, uint32_t len);
+/* the same, but call `f` with every maximal range of dirty pages,
+ * clipped to [addr, addr + len) */
+void mmio_fetch_dirty_ranges(paddr_t addr, uint32_t len,
+        void (*f)(paddr_t addr, uint32_t len, void *arg), void *arg);
+
 word_t map_read(paddr_t addr, int len, IOMap *map);
 void map_write(paddr_t addr, int len, word_t data, IOMap *map);
 
@@ -36,6 +36,12 @@ word_t isa_reg_str2val(const char *name, bool *success);
 // exec
 struct Decode;
 int isa_exec_once(struct Decode *s);
+uint64_t isa_exec_threaded(vaddr_t pc, uint64_t n);
+void isa_fuse_next(struct Decode *s);
+int isa_fetch_decode(struct Decode *s);
+bool isa_is_block_end(struct Decode *s);
+struct Block;
+uint8_t* isa_jit_compile(struct Block *b, uint8_t *code, uint8_t *code_end);
 
 // memory
 enum { MMU_DIRECT, MMU_TRANSLATE, MMU_FAIL };
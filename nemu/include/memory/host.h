@@ -18,6 +18,17 @@
 
 #include <common.h>
 
+// the widths of the specialized memory accesses in bits
+#define MEM_WIDTHS(f) f(8) f(16) f(32) IFDEF(CONFIG_ISA64, f(64))
+
+// convert a constant length in bytes to bits, so that an access with a
+// constant length can be bound to the specialized version by concat()
+#define MEM_BITS_1 8
+#define MEM_BITS_2 16
+#define MEM_BITS_4 32
+#define MEM_BITS_8 64
+#define MEM_BITS(len) concat(MEM_BITS_, len)
+
 static inline word_t host_read(void *addr, int len) {
   switch (len) {
     case 1: return *(uint8_t  *)addr;
@@ -38,4 +49,20 @@ static inline void host_write(void *addr, int len, word_t data) {
   }
 }
 
+#ifdef CONFIG_PMEM_MMAP
+#define HUGE_PAGE_SIZE (2ul << 20)
+
+/* Map `size` bytes of host memory, which are committed when touched, and
+ * backed by huge pages if they are enabled. An inaccessible mapping is
+ * made accessible by mprotect() in units of host_map_unit(). */
+uint8_t* host_map(const char *name, size_t size, bool accessible);
+/* Return whether `p` is in a mapping of host_map() backed by hugetlbfs,
+ * which can not be remapped in units smaller than a huge page. */
+bool host_is_hugetlb(const void *p);
+
+static inline size_t host_map_unit() {
+  return MUXDEF(CONFIG_HUGEPAGE_NONE, 4096, HUGE_PAGE_SIZE);
+}
+#endif
+
 #endif
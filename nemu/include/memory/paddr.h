@@ -17,6 +17,7 @@
 #define __MEMORY_PADDR_H__
 
 #include <common.h>
+#include <memory/host.h>
 
 #define PMEM_LEFT  ((paddr_t)CONFIG_MBASE)
 #define PMEM_RIGHT ((paddr_t)CONFIG_MBASE + CONFIG_MSIZE - 1)
@@ -26,6 +27,14 @@
 uint8_t* guest_to_host(paddr_t paddr);
 /* convert the host virtual address in NEMU to guest physical address in the guest program */
 paddr_t host_to_guest(uint8_t *haddr);
+/* make the pages ready before they are written by the kernel */
+void pmem_prefault(paddr_t addr, size_t len);
+void host_prefault(uint8_t *p, size_t len);
+/* allocate a bank of memory outside pmem, initialized in the same way */
+uint8_t* paddr_new_bank(const char *name, size_t size, bool is_ram);
+/* load a part of a file, or fill zero, lazily if possible */
+void pmem_load_file(paddr_t addr, int fd, uint64_t offset, size_t size);
+void pmem_zero(paddr_t addr, size_t size);
 
 static inline bool in_pmem(paddr_t addr) {
   return addr - CONFIG_MBASE < CONFIG_MSIZE;
@@ -34,4 +43,24 @@ static inline bool in_pmem(paddr_t addr) {
 word_t paddr_read(paddr_t addr, int len);
 void paddr_write(paddr_t addr, int len, word_t data);
 
+/* paddr_read8(), paddr_write8(), paddr_read16(), ... */
+#define decl_paddr_access(bits) \
+  word_t concat(paddr_read, bits)(paddr_t addr); \
+  void concat(paddr_write, bits)(paddr_t addr, word_t data);
+MAP(MEM_WIDTHS, decl_paddr_access)
+
+/* pages of pmem which are written since they are cleared */
+#ifdef CONFIG_PMEM_DIRTY
+void pmem_set_dirty(paddr_t addr);
+bool pmem_is_dirty(paddr_t addr, size_t len);
+void pmem_clear_dirty(paddr_t addr, size_t len);
+void pmem_foreach_dirty(void (*f)(paddr_t addr, size_t len, void *arg), void *arg);
+uint8_t* pmem_dirty_map();
+#endif
+
+/* stores to a protected page are never performed directly on the host
+ * memory by the TLB, so that they can invalidate cached instructions */
+void paddr_protect(paddr_t addr);
+bool paddr_is_protected(paddr_t addr);
+
 #endif
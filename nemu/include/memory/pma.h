@@ -0,0 +1,51 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __MEMORY_PMA_H__
+#define __MEMORY_PMA_H__
+
+#include <common.h>
+
+// Physical memory attributes: the physical address space is described
+// by a table of regions. Accesses to pmem never look up the table, and
+// other accesses find their region and call its handlers.
+
+enum { PMA_NONE, PMA_RAM, PMA_ROM, PMA_MMIO };
+
+#define PMA_R 0x1
+#define PMA_W 0x2
+#define PMA_X 0x4
+
+typedef struct PMARegion {
+  const char *name;
+  paddr_t low;
+  paddr_t high;
+  int type;
+  int perm;
+  uint8_t *host;            // the backing memory of RAM and ROM
+  uint8_t *protected_page;  // see paddr_protect()
+  word_t (*read)(struct PMARegion *r, paddr_t addr, int len);
+  void (*write)(struct PMARegion *r, paddr_t addr, int len, word_t data);
+} PMARegion;
+
+PMARegion* pma_add(const char *name, int type, paddr_t addr, paddr_t len, uint8_t *host);
+PMARegion* pma_find(paddr_t addr);
+word_t pma_read(paddr_t addr, int len);
+void pma_write(paddr_t addr, int len, word_t data);
+uint8_t* pma_direct_page(paddr_t addr, int type);
+void pma_load_file(paddr_t addr, int fd, uint64_t offset, size_t size);
+void init_board(const char *file);
+
+#endif
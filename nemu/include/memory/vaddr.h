@@ -17,11 +17,25 @@
 #define __MEMORY_VADDR_H__
 
 #include <common.h>
+#include <memory/host.h>
 
 word_t vaddr_ifetch(vaddr_t addr, int len);
 word_t vaddr_read(vaddr_t addr, int len);
 void vaddr_write(vaddr_t addr, int len, word_t data);
 
+/* vaddr_read8(), vaddr_write8(), vaddr_read16(), ... */
+#define decl_vaddr_access(bits) \
+  word_t concat(vaddr_read, bits)(vaddr_t addr); \
+  void concat(vaddr_write, bits)(vaddr_t addr, word_t data);
+MAP(MEM_WIDTHS, decl_vaddr_access)
+
+#ifdef CONFIG_SOFT_TLB
+/* drop all cached translations, e.g. when the page table base is changed */
+void tlb_flush();
+#else
+static inline void tlb_flush() {}
+#endif
+
 #define PAGE_SHIFT        12
 #define PAGE_SIZE         (1ul << PAGE_SHIFT)
 #define PAGE_MASK         (PAGE_SIZE - 1)
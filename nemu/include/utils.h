@@ -33,6 +33,27 @@ extern NEMUState nemu_state;
 // ----------- timer -----------
 
 uint64_t get_time();
+uint64_t get_guest_time();
+
+// ----------- symbol -----------
+
+const char* symbol_lookup(vaddr_t addr, vaddr_t *offset);
+
+// ----------- asynchronous writer -----------
+
+typedef struct AsyncWriter AsyncWriter;
+// called in the writer thread with every committed slot
+typedef void (*writer_handler_t)(FILE *fp, void *slot, size_t len, void *arg);
+
+// Slots are filled by one thread and written to `fp` by a background
+// thread. writer_acquire() returns NULL instead of waiting if all of
+// them are busy, while writer_acquire_wait() waits for a free slot.
+AsyncWriter* writer_open(FILE *fp, int nr_slot, size_t slot_size,
+    writer_handler_t handler, void *arg);
+void* writer_acquire(AsyncWriter *w);
+void* writer_acquire_wait(AsyncWriter *w);
+void writer_commit(AsyncWriter *w, size_t len);
+void writer_close(AsyncWriter *w);
 
 // ----------- log -----------
 
@@ -28,7 +28,9 @@ LDFLAGS := -O2 $(LDFLAGS)
 OBJS = $(SRCS:%.c=$(OBJ_DIR)/%.o) $(CXXSRC:%.cc=$(OBJ_DIR)/%.o)
 
 # Compilation patterns
-$(OBJ_DIR)/%.o: %.c
+# Generated headers must exist before the first compilation. Later changes
+# of them are tracked by the dependency files.
+$(OBJ_DIR)/%.o: %.c | $(GEN_HEADERS)
 	@echo + CC $<
 	@mkdir -p $(dir $@)
 	@$(CC) $(CFLAGS) -c -o $@ $<
@@ -0,0 +1,171 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/decode.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#ifdef CONFIG_ENGINE_JIT
+#include <sys/mman.h>
+#endif
+
+#define MAX_BLOCK_INST 64
+#define NR_BLOCK (1 << 15)
+#define NR_BLOCK_INST (1 << 18)
+#define NR_HASH (1 << 14)
+#define HASH(pc) (((pc) >> 2) & (NR_HASH - 1))
+
+#define NR_CODE_PAGE (CONFIG_MSIZE >> PAGE_SHIFT)
+#define NR_CODE_WORD (CONFIG_MSIZE >> 2)
+
+static Block blocks[NR_BLOCK] = {};
+static Decode block_inst[NR_BLOCK_INST] = {};
+static Block *htab[NR_HASH] = {};
+static int nr_block = 0, nr_block_inst = 0;
+// blocks translated before the latest flush have an older generation,
+// and they should be neither executed nor chained any more
+uint32_t g_block_gen = 0;
+
+// pages of pmem which contain any translated instruction, and
+// the 4-byte words of pmem which are translated
+static uint8_t code_page[NR_CODE_PAGE] = {};
+static uint8_t code_word[NR_CODE_WORD / 8] = {};
+
+static void mark_code(paddr_t addr) {
+  paddr_protect(addr);
+  if (!in_pmem(addr)) return;
+  uint32_t word = (addr - CONFIG_MBASE) >> 2;
+  code_page[word >> (PAGE_SHIFT - 2)] = 1;
+  code_word[word / 8] |= 1 << (word % 8);
+}
+
+static bool is_code(paddr_t addr) {
+  if (!in_pmem(addr)) return false;
+  uint32_t word = (addr - CONFIG_MBASE) >> 2;
+  return code_page[word >> (PAGE_SHIFT - 2)] && (code_word[word / 8] & (1 << (word % 8)));
+}
+
+#ifdef CONFIG_ENGINE_JIT
+// the code of a block should never exceed this size
+#define MAX_BLOCK_CODE (MAX_BLOCK_INST * 256 + 64)
+
+static uint8_t *code_cache = NULL, *code_ptr = NULL;
+
+static void init_code_cache() {
+  code_cache = mmap(NULL, CONFIG_JIT_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  Assert(code_cache != MAP_FAILED, "failed to allocate the code cache");
+  code_ptr = code_cache;
+}
+
+const uint8_t* block_cache_code_page() { return code_page; }
+#endif
+
+void block_cache_flush() {
+  for (int i = 0; i < NR_CODE_PAGE; i ++) {
+    if (code_page[i]) {
+      memset(&code_word[(i << (PAGE_SHIFT - 2)) / 8], 0, (PAGE_SIZE >> 2) / 8);
+      code_page[i] = 0;
+    }
+  }
+  memset(htab, 0, sizeof(htab));
+  nr_block = 0;
+  nr_block_inst = 0;
+  IFDEF(CONFIG_ENGINE_JIT, code_ptr = code_cache);
+  g_block_gen ++;
+}
+
+static Block* translate(vaddr_t pc) {
+  if (nr_block == NR_BLOCK || nr_block_inst + MAX_BLOCK_INST > NR_BLOCK_INST) {
+    block_cache_flush();
+  }
+
+  Block *b = &blocks[nr_block ++];
+  b->pc = pc;
+  b->inst = &block_inst[nr_block_inst];
+  b->gen = g_block_gen;
+  b->succ_pc[0] = b->succ_pc[1] = 0;
+  b->succ[0] = b->succ[1] = NULL;
+  IFDEF(CONFIG_ENGINE_JIT, b->nr_exec = 0);
+  IFDEF(CONFIG_ENGINE_JIT, b->jit = NULL);
+
+  // a block ends at a control transfer, at a page boundary,
+  // or when it is long enough
+  vaddr_t page = pc & ~PAGE_MASK;
+  int n = 0;
+  Decode *s;
+  do {
+    s = &b->inst[n ++];
+    s->pc = pc;
+    s->snpc = pc;
+    isa_fetch_decode(s);
+    for (vaddr_t a = pc; a < s->snpc; a += 4) mark_code(a);
+    pc = s->snpc;
+  } while (n < MAX_BLOCK_INST && (pc & ~PAGE_MASK) == page && !isa_is_block_end(s));
+
+  b->nr_inst = n;
+  nr_block_inst += n;
+
+  int idx = HASH(b->pc);
+  b->hnext = htab[idx];
+  htab[idx] = b;
+  return b;
+}
+
+static Block* lookup(vaddr_t pc) {
+  for (Block *b = htab[HASH(pc)]; b != NULL; b = b->hnext) {
+    if (b->pc == pc) return b;
+  }
+  return translate(pc);
+}
+
+// Return the block starting at `pc`, which is executed after block `b`.
+// The successor is chained to `b` so that the hash table is only looked
+// up the first time this exit is taken.
+Block* block_cache_next(Block *b, vaddr_t pc) {
+  if (b == NULL || b->gen != g_block_gen) return lookup(pc);
+  if (likely(b->succ_pc[0] == pc && b->succ[0] != NULL)) return b->succ[0];
+  if (likely(b->succ_pc[1] == pc && b->succ[1] != NULL)) return b->succ[1];
+
+  Block *next = lookup(pc);
+  if (b->gen == g_block_gen) {
+    int i = (b->succ[0] == NULL ? 0 : 1);
+    b->succ_pc[i] = pc;
+    b->succ[i] = next;
+  }
+  return next;
+}
+
+void block_cache_invalidate(paddr_t addr, int len) {
+  paddr_t first = addr & ~(paddr_t)3, last = (addr + len - 1) & ~(paddr_t)3;
+  if (likely(!is_code(first) && !is_code(last))) return;
+  block_cache_flush();
+}
+
+#ifdef CONFIG_ENGINE_JIT
+// Compile block `b` to host code. If the code cache is full, all blocks
+// are flushed, and `b` is compiled again when it becomes hot once more.
+void block_cache_jit(Block *b) {
+  if (code_cache == NULL) init_code_cache();
+  if (code_cache + CONFIG_JIT_CACHE_SIZE - code_ptr < MAX_BLOCK_CODE) {
+    block_cache_flush();
+    return;
+  }
+  uint8_t *end = isa_jit_compile(b, code_ptr, code_ptr + MAX_BLOCK_CODE);
+  if (end != code_ptr) {
+    b->jit = (int (*)(void))code_ptr;
+    code_ptr = end;
+  }
+}
+#endif
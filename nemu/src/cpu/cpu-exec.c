@@ -16,6 +16,7 @@
 #include <cpu/cpu.h>
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
+#include <device/event.h>
 #include <locale.h>
 #include "../monitor/sdb/sdb.h"
 
@@ -31,24 +32,57 @@ uint64_t g_nr_guest_inst = 0;
 static uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
 
-void device_update();
+#if defined(CONFIG_THREADED_CODE)
+// devices are checked after every batch of instructions
+#define THREADED_BATCH 1024
 
-static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
+static void execute(uint64_t n) {
+  while (n > 0) {
+    uint64_t batch = (n < THREADED_BATCH ? n : THREADED_BATCH);
+    IFDEF(CONFIG_DEVICE, batch = event_clamp(batch));
+    uint64_t nr_inst = isa_exec_threaded(cpu.pc, batch);
+    g_nr_guest_inst += nr_inst;
+    n -= nr_inst;
+    if (nemu_state.state != NEMU_RUNNING) break;
+    IFDEF(CONFIG_DEVICE, device_update());
+  }
+}
+#elif !defined(CONFIG_BLOCK_CACHE)
+static void trace_and_difftest(Decode *_this, vaddr_t dnpc, int nr_inst) {
 #ifdef CONFIG_ITRACE_COND
   if (ITRACE_COND) { log_write("%s\n", _this->logbuf); }
 #endif
   if (g_print_step) { IFDEF(CONFIG_ITRACE, puts(_this->logbuf)); }
-  IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, dnpc));
+  IFDEF(CONFIG_DIFFTEST, difftest_step_n(_this->pc, dnpc, nr_inst));
 
   IFDEF(CONFIG_WATCHPOINT, check_watchpoint());
 }
 
-static void exec_once(Decode *s, vaddr_t pc) {
+// Execute the instruction at `pc`, or a fused pair of instructions
+// if at least 2 instructions are allowed. Set `nr_inst` to the number
+// of executed instructions.
+static Decode* exec_once(Decode *s, vaddr_t pc, uint64_t n, int *nr_inst) {
+  *nr_inst = 1;
+#ifdef CONFIG_DECODE_CACHE
+  s = decode_cache_lookup(pc);
+#ifdef CONFIG_INST_FUSION
+  if (s->FHelper != NULL && n >= 2) {
+    s->FHelper(s);
+    *nr_inst = 2;
+  } else
+#endif
+  s->EHelper(s);
+#else
   s->pc = pc;
   s->snpc = pc;
   isa_exec_once(s);
+#endif
   cpu.pc = s->dnpc;
+  return s;
+}
+
 #ifdef CONFIG_ITRACE
+static void itrace_fmt(Decode *s) {
   char *p = s->logbuf;
   p += snprintf(p, sizeof(s->logbuf), FMT_WORD ":", s->pc);
   int ilen = s->snpc - s->pc;
@@ -71,19 +105,130 @@ static void exec_once(Decode *s, vaddr_t pc) {
   void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
   disassemble(p, s->logbuf + sizeof(s->logbuf) - p,
       MUXDEF(CONFIG_ISA_x86, s->snpc, s->pc), (uint8_t *)&s->isa.inst, ilen);
+
+#ifndef CONFIG_TARGET_AM
+  // the symbol from the ELF image, if any
+  vaddr_t offset;
+  const char *name = symbol_lookup(s->pc, &offset);
+  if (name != NULL) {
+    p += strlen(p);
+    snprintf(p, s->logbuf + sizeof(s->logbuf) - p, "  <%s+" FMT_WORD ">", name, offset);
+  }
 #endif
 }
+#endif
 
-static void execute(uint64_t n) {
+// The hooks are re-examined after every batch, so that features
+// enabled or disabled in sdb take effect in the next batch.
+#define EXEC_BATCH 1024
+
+// Return whether any per-instruction hook is active during the next
+// `n` instructions, and shrink `n` to the start of the trace window.
+static bool need_hooks(uint64_t *n) {
+  if (MUXDEF(CONFIG_DIFFTEST, difftest_is_attached(), false)) return true;
+  if (MUXDEF(CONFIG_WATCHPOINT, wp_exist(), false)) return true;
+#ifdef CONFIG_ITRACE
+  extern bool log_enable();
+  if (g_print_step || log_enable()) return true;
+  if (g_nr_guest_inst < CONFIG_TRACE_START && CONFIG_TRACE_START - g_nr_guest_inst < *n) {
+    *n = CONFIG_TRACE_START - g_nr_guest_inst;
+  }
+#endif
+  return false;
+}
+
+// Execute `n` instructions with itrace, difftest and watchpoints,
+// and update devices after every instruction. Instructions are not
+// fused here, so that every hook observes every instruction.
+static void execute_instrumented(uint64_t n) {
+  Decode s;
+  while (n > 0) {
+    int nr_inst;
+    Decode *ps = exec_once(&s, cpu.pc, 1, &nr_inst);
+    g_nr_guest_inst += nr_inst;
+    n -= nr_inst;
+    IFDEF(CONFIG_ITRACE, itrace_fmt(ps));
+    trace_and_difftest(ps, cpu.pc, nr_inst);
+    if (nemu_state.state != NEMU_RUNNING) break;
+    IFDEF(CONFIG_DEVICE, device_update());
+  }
+}
+
+// Execute `n` instructions without any per-instruction hook.
+static void execute_fast(uint64_t n) {
   Decode s;
-  for (;n > 0; n --) {
-    exec_once(&s, cpu.pc);
-    g_nr_guest_inst ++;
-    trace_and_difftest(&s, cpu.pc);
+  while (n > 0) {
+    int nr_inst;
+    exec_once(&s, cpu.pc, n, &nr_inst);
+    g_nr_guest_inst += nr_inst;
+    n -= nr_inst;
+    if (unlikely(nemu_state.state != NEMU_RUNNING)) break;
+  }
+}
+
+static void execute(uint64_t n) {
+  while (n > 0) {
+    uint64_t batch = (n < EXEC_BATCH ? n : EXEC_BATCH);
+    // stop at the next checkpoint of device events
+    IFDEF(CONFIG_DEVICE, batch = event_clamp(batch));
+    uint64_t start = g_nr_guest_inst;
+    if (need_hooks(&batch)) execute_instrumented(batch);
+    else {
+      execute_fast(batch);
+      if (nemu_state.state != NEMU_RUNNING) break;
+      IFDEF(CONFIG_DEVICE, device_update());
+    }
+    n -= g_nr_guest_inst - start;
+    if (nemu_state.state != NEMU_RUNNING) break;
+  }
+}
+#else
+// Execute at most `n` instructions of block `b`, and return
+// the last executed instruction.
+static Decode* exec_block(Block *b, uint64_t n) {
+  Decode *s = b->inst;
+  Decode *last = s + (n < b->nr_inst ? n : b->nr_inst) - 1;
+  for (; ; s ++) {
+    s->EHelper(s);
+    // leave the block if the control flow is changed, or the block is
+    // flushed because of a store to the code
+    if (unlikely(s->dnpc != s->snpc || b->gen != g_block_gen ||
+          difftest_skip_pending())) break;
+    if (s == last) break;
+  }
+  cpu.pc = s->dnpc;
+  return s;
+}
+
+static void execute(uint64_t n) {
+  Block *b = NULL;
+  while (n > 0) {
+    b = block_cache_next(b, cpu.pc);
+    uint64_t limit = n;
+#if defined(CONFIG_ICOUNT) && defined(CONFIG_DEVICE)
+    // split the block so that device events happen at exact instruction counts
+    limit = event_clamp(limit);
+#endif
+    Decode *s;
+#ifdef CONFIG_ENGINE_JIT
+    if (b->jit != NULL && limit >= b->nr_inst) s = &b->inst[b->jit() - 1];
+    else {
+      s = exec_block(b, limit);
+      if (++ b->nr_exec == CONFIG_JIT_THRESHOLD && b->gen == g_block_gen) block_cache_jit(b);
+    }
+#else
+    s = exec_block(b, limit);
+#endif
+    int nr_inst = s - b->inst + 1;
+    g_nr_guest_inst += nr_inst;
+    n -= nr_inst;
+    IFDEF(CONFIG_DIFFTEST, difftest_step_n(s->pc, cpu.pc, nr_inst));
+    IFDEF(CONFIG_WATCHPOINT, check_watchpoint());
     if (nemu_state.state != NEMU_RUNNING) break;
     IFDEF(CONFIG_DEVICE, device_update());
   }
 }
+#endif
 
 static void statistic() {
   IFNDEF(CONFIG_TARGET_AM, setlocale(LC_NUMERIC, ""));
@@ -92,6 +237,7 @@ static void statistic() {
   Log("total guest instructions = " NUMBERIC_FMT, g_nr_guest_inst);
   if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " inst/s", g_nr_guest_inst * 1000000 / g_timer);
   else Log("Finish running in less than 1 us and can not calculate the simulation frequency");
+  IFDEF(CONFIG_DEVICE, device_statistic());
 }
 
 void assert_fail_msg() {
@@ -125,6 +271,13 @@ void cpu_exec(uint64_t n) {
            (nemu_state.halt_ret == 0 ? ANSI_FMT("HIT GOOD TRAP", ANSI_FG_GREEN) :
             ANSI_FMT("HIT BAD TRAP", ANSI_FG_RED))),
           nemu_state.halt_pc);
+#ifndef CONFIG_TARGET_AM
+      {
+        vaddr_t offset;
+        const char *name = symbol_lookup(nemu_state.halt_pc, &offset);
+        if (name != NULL) Log("nemu: halt in %s+" FMT_WORD, name, offset);
+      }
+#endif
       // fall through
     case NEMU_QUIT: statistic();
   }
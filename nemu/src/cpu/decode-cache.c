@@ -0,0 +1,67 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/decode.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+
+#define NR_CODE_PAGE (CONFIG_MSIZE >> PAGE_SHIFT)
+
+static_assert((NR_DCACHE & (NR_DCACHE - 1)) == 0, "decode cache size should be a power of 2");
+
+Decode g_dcache[NR_DCACHE] = {};
+// pages of pmem which contain any decoded instruction
+static uint8_t code_page[NR_CODE_PAGE] = {};
+
+Decode* decode_cache_fill(Decode *s, vaddr_t pc) {
+  s->pc = pc;
+  s->snpc = pc;
+  isa_fetch_decode(s);
+  IFDEF(CONFIG_INST_FUSION, isa_fuse_next(s));
+  if (in_pmem(pc)) code_page[(pc - CONFIG_MBASE) >> PAGE_SHIFT] = 1;
+  paddr_protect(pc);
+  return s;
+}
+
+static inline bool is_code_page(paddr_t addr) {
+  return in_pmem(addr) && code_page[(addr - CONFIG_MBASE) >> PAGE_SHIFT];
+}
+
+static void invalidate_one(paddr_t addr) {
+  Decode *s = &g_dcache[DCACHE_IDX(addr)];
+  // only clear the helper, since the invalidated instruction may be
+  // the one which is executing the store
+  if (s->pc == addr) s->EHelper = NULL;
+#ifdef CONFIG_INST_FUSION
+  // the instruction may also be the second one of a fused pair
+  Decode *prev = &g_dcache[DCACHE_IDX(addr - 4)];
+  if (prev->pc == addr - 4) prev->FHelper = NULL;
+#endif
+}
+
+void decode_cache_invalidate(paddr_t addr, int len) {
+  paddr_t first = addr & ~(paddr_t)3, last = (addr + len - 1) & ~(paddr_t)3;
+  if (likely(!is_code_page(first) && !is_code_page(last))) return;
+  for (paddr_t a = first; a <= last; a += 4) {
+    invalidate_one(a);
+  }
+}
+
+void decode_cache_flush() {
+  for (int i = 0; i < NR_DCACHE; i ++) {
+    g_dcache[i].EHelper = NULL;
+  }
+  memset(code_page, 0, sizeof(code_page));
+}
@@ -18,6 +18,7 @@
 #include <isa.h>
 #include <cpu/cpu.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
 #include <utils.h>
 #include <difftest-def.h>
 
@@ -30,6 +31,13 @@ void (*ref_difftest_raise_intr)(uint64_t NO) = NULL;
 
 static bool is_skip_ref = false;
 static int skip_dut_nr_inst = 0;
+// whether the reference design checks the DUT; it is not attached if
+// no reference is given, or it is detached in sdb
+static bool is_attached = false;
+
+bool difftest_is_attached() {
+  return is_attached;
+}
 
 // this is used to let ref skip instructions which
 // can not produce consistent behavior with NEMU
@@ -60,7 +68,10 @@ void difftest_skip_dut(int nr_ref, int nr_dut) {
 }
 
 void init_difftest(char *ref_so_file, long img_size, int port) {
-  assert(ref_so_file != NULL);
+  if (ref_so_file == NULL) {
+    Log("Differential testing: %s, no reference is given", ANSI_FMT("OFF", ANSI_FG_RED));
+    return;
+  }
 
   void *handle;
   handle = dlopen(ref_so_file, RTLD_LAZY);
@@ -89,6 +100,27 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
   ref_difftest_init(port);
   ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
   ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+  is_attached = true;
+}
+
+void difftest_detach() {
+  is_attached = false;
+}
+
+// Copy the state of the DUT to the reference, and check again from now on.
+void difftest_attach() {
+  if (ref_difftest_exec == NULL) {
+    printf("No reference is given by --diff\n");
+    return;
+  }
+  is_skip_ref = false;
+  skip_dut_nr_inst = 0;
+  ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), PMEM_RIGHT - RESET_VECTOR + 1, DIFFTEST_TO_REF);
+  ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+  isa_difftest_attach();
+  is_attached = true;
+  // MMIO is no longer accessed through the TLB directly
+  tlb_flush();
 }
 
 static void checkregs(CPU_state *ref, vaddr_t pc) {
@@ -127,6 +159,21 @@ void difftest_step(vaddr_t pc, vaddr_t npc) {
 
   checkregs(&ref_r, pc);
 }
+
+// this is used by the block engine to check `n` instructions at once,
+// where `pc` is the last one. Only the last instruction is allowed to
+// request skipping, since the block is left once it is requested.
+void difftest_step_n(vaddr_t pc, vaddr_t npc, int n) {
+  if (!is_attached) return;
+  if (n > 1 && skip_dut_nr_inst == 0) {
+    ref_difftest_exec(n - 1);
+  }
+  difftest_step(pc, npc);
+}
+
+bool difftest_skip_pending() {
+  return is_skip_ref;
+}
 #else
 void init_difftest(char *ref_so_file, long img_size, int port) { }
 #endif
@@ -15,7 +15,13 @@
 
 #include <common.h>
 #include <device/map.h>
+#include <stdatomic.h>
+#ifdef CONFIG_AUDIO_WAV
+#include <utils.h>
+#include <device/event.h>
+#else
 #include <SDL2/SDL.h>
+#endif
 
 enum {
   reg_freq,
@@ -30,12 +36,256 @@ enum {
 static uint8_t *sbuf = NULL;
 static uint32_t *audio_base = NULL;
 
+// sbuf is a ring written by the guest and read by the SDL audio callback,
+// or by the WAV writer.
+// The total number of bytes written and read are only updated by their
+// own side, and the count of bytes in the ring is their difference, so
+// neither side takes a lock or waits for the other.
+static _Atomic uint64_t nr_produce = 0, nr_consume = 0;
+// the count of the last read of reg_count by the guest
+static uint32_t count_seen = 0;
+static _Atomic uint64_t nr_underrun = 0;
+static uint64_t nr_overrun = 0;
+static bool playing = false;
+// the bytes consumed by the streams opened before
+static uint64_t nr_consume_total = 0;
+// The stream can not be played, and the bytes written by the guest are
+// consumed at once and dropped, so that the guest never waits for space.
+static bool dropping = false;
+static uint64_t nr_drop = 0;
+
+// Copy at most `len` bytes from the ring to `buf`, and fill the rest with silence.
+static void audio_consume(uint8_t *buf, uint32_t len) {
+  uint64_t head = atomic_load_explicit(&nr_consume, memory_order_relaxed);
+  uint64_t tail = atomic_load_explicit(&nr_produce, memory_order_acquire);
+  uint32_t n = (tail - head < len ? tail - head : len);
+  uint32_t pos = head % CONFIG_SB_SIZE;
+  uint32_t n1 = (n < CONFIG_SB_SIZE - pos ? n : CONFIG_SB_SIZE - pos);
+  memcpy(buf, sbuf + pos, n1);
+  memcpy(buf + n1, sbuf, n - n1);
+  memset(buf + n, 0, len - n);
+  atomic_store_explicit(&nr_consume, head + n, memory_order_release);
+  // a gap in the stream which is being played
+  if (n < len && playing) atomic_fetch_add_explicit(&nr_underrun, 1, memory_order_relaxed);
+  playing = (n == len);
+}
+
+#ifdef CONFIG_AUDIO_WAV
+// The stream is consumed by an event at the rate of the guest time, and
+// written to the WAV file by a background writer. The slots are only
+// waited for if the disk falls far behind, so that no sample is lost.
+#define WAV_SLOT_SIZE (64 * 1024)
+#define WAV_NR_SLOT 16
+#define WAV_PERIOD 1000 // us
+// the sizes in the header are 32-bit
+#define WAV_MAX_SIZE UINT32_MAX
+
+typedef struct __attribute__((packed)) {
+  char riff[4];
+  uint32_t riff_size;
+  char wave[4], fmt[4];
+  uint32_t fmt_size;
+  uint16_t format, channels;
+  uint32_t freq, byte_rate;
+  uint16_t block_align, bits;
+  char data[4];
+  uint32_t data_size;
+} WavHeader;
+
+static FILE *wav_fp = NULL;
+static AsyncWriter *wav_writer = NULL;
+static uint8_t *wav_slot = NULL;
+static uint32_t wav_slot_len = 0;
+static uint32_t wav_freq = 0, wav_channels = 0;
+// The guest time when the stream starts, and the bytes consumed since then.
+// The stream starts at the first tick after it is opened, since the
+// instruction count is only exact at the checkpoints of events.
+static uint64_t wav_start = 0, wav_clock = 0;
+static bool wav_started = false;
+static uint64_t wav_nr_byte = 0, wav_nr_stall = 0;
+
+static void wav_write(FILE *fp, void *slot, size_t len, void *arg) {
+  fwrite(slot, len, 1, fp);
+}
+
+static void wav_write_header() {
+  WavHeader h = { .riff_size = sizeof(WavHeader) - 8 + wav_nr_byte, .fmt_size = 16,
+    .format = 1, .channels = wav_channels, .freq = wav_freq, .byte_rate = wav_freq * wav_channels * 2,
+    .block_align = wav_channels * 2, .bits = 16, .data_size = wav_nr_byte };
+  memcpy(h.riff, "RIFF", 4);
+  memcpy(h.wave, "WAVE", 4);
+  memcpy(h.fmt, "fmt ", 4);
+  memcpy(h.data, "data", 4);
+  fseek(wav_fp, 0, SEEK_SET);
+  fwrite(&h, sizeof(h), 1, wav_fp);
+}
+
+static void wav_flush() {
+  if (wav_slot == NULL) return;
+  writer_commit(wav_writer, wav_slot_len);
+  wav_slot = NULL;
+  wav_slot_len = 0;
+}
+
+static void wav_tick() {
+  if (wav_freq == 0) return;
+  if (!wav_started) {
+    wav_start = get_guest_time();
+    wav_started = true;
+    return;
+  }
+  uint32_t frame = wav_channels * 2;
+  uint64_t target = (get_guest_time() - wav_start) * wav_freq / 1000000 * frame;
+  uint64_t max_data = (WAV_MAX_SIZE - (sizeof(WavHeader) - 8)) / frame * frame;
+  while (wav_clock < target) {
+    if (wav_nr_byte >= max_data) {
+      // the file is full, and the samples are still consumed but dropped
+      static uint8_t discard[WAV_SLOT_SIZE];
+      uint32_t n = sizeof(discard);
+      if (target - wav_clock < n) n = target - wav_clock;
+      audio_consume(discard, n);
+      wav_clock += n;
+      continue;
+    }
+    if (wav_slot == NULL) {
+      wav_slot = writer_acquire(wav_writer);
+      if (wav_slot == NULL) {
+        wav_nr_stall ++;
+        wav_slot = writer_acquire_wait(wav_writer);
+      }
+    }
+    uint32_t n = WAV_SLOT_SIZE - wav_slot_len;
+    if (target - wav_clock < n) n = target - wav_clock;
+    if (max_data - wav_nr_byte < n) n = max_data - wav_nr_byte;
+    audio_consume(wav_slot + wav_slot_len, n);
+    wav_slot_len += n;
+    wav_clock += n;
+    wav_nr_byte += n;
+    if (wav_nr_byte == max_data) {
+      Log("audio: %s reaches the size limit of WAV, and the rest of the stream is dropped",
+          CONFIG_AUDIO_WAV_FILE);
+    }
+    if (wav_slot_len == WAV_SLOT_SIZE) wav_flush();
+  }
+}
+
+static void wav_open() {
+  if (wav_freq != 0 && (wav_freq != audio_base[reg_freq] || wav_channels != audio_base[reg_channels])) {
+    Log("audio: the format is changed, and the header of %s only describes the last one", CONFIG_AUDIO_WAV_FILE);
+  }
+  wav_freq = audio_base[reg_freq];
+  wav_channels = audio_base[reg_channels];
+  wav_started = false;
+  wav_clock = 0;
+}
+
+static void close_wav() {
+  wav_flush();
+  writer_close(wav_writer);
+  wav_write_header();
+  fclose(wav_fp);
+}
+
+static void init_wav() {
+  wav_fp = fopen(CONFIG_AUDIO_WAV_FILE, "wb");
+  Assert(wav_fp, "Can not open '%s'", CONFIG_AUDIO_WAV_FILE);
+  // the sizes are filled when the file is closed
+  wav_write_header();
+  wav_writer = writer_open(wav_fp, WAV_NR_SLOT, WAV_SLOT_SIZE, wav_write, NULL);
+  add_event("audio", WAV_PERIOD, wav_tick);
+  atexit(close_wav);
+  Log("The audio stream is written to %s", CONFIG_AUDIO_WAV_FILE);
+}
+#else
+static void audio_play(void *userdata, uint8_t *stream, int len) {
+  audio_consume(stream, len);
+}
+#endif
+
+static uint32_t audio_count() {
+  return atomic_load_explicit(&nr_produce, memory_order_relaxed) -
+         atomic_load_explicit(&nr_consume, memory_order_acquire);
+}
+
+// The guest adds the number of bytes it writes to sbuf to the count it
+// reads, while the callback may consume some bytes in between. Only the
+// difference is added, so that the bytes consumed are not counted again.
+// The guest can not take bytes back from the ring.
+static void audio_produce(uint32_t count) {
+  int32_t delta = count - count_seen;
+  uint64_t tail = atomic_load_explicit(&nr_produce, memory_order_relaxed) + (delta > 0 ? delta : 0);
+  uint64_t head = atomic_load_explicit(&nr_consume, memory_order_acquire);
+  if (tail - head > CONFIG_SB_SIZE) {
+    // the guest overwrites the bytes which are not played yet
+    nr_overrun ++;
+    tail = head + CONFIG_SB_SIZE;
+  }
+  atomic_store_explicit(&nr_produce, tail, memory_order_release);
+  if (dropping) {
+    // there is no consumer running, so it is safe to move the head here
+    nr_drop += tail - head;
+    atomic_store_explicit(&nr_consume, tail, memory_order_release);
+    head = tail;
+  }
+  count_seen = tail - head;
+}
+
+static void audio_open() {
+  IFNDEF(CONFIG_AUDIO_WAV, SDL_CloseAudio());
+  // the consumer of the last stream is stopped, and the statistics are kept
+  nr_consume_total += atomic_load(&nr_consume);
+  dropping = false;
+  atomic_store(&nr_produce, 0);
+  atomic_store(&nr_consume, 0);
+  count_seen = 0;
+  playing = false;
+#ifdef CONFIG_AUDIO_WAV
+  wav_open();
+#else
+  SDL_AudioSpec s = {};
+  s.freq = audio_base[reg_freq];
+  s.format = AUDIO_S16SYS;
+  s.channels = audio_base[reg_channels];
+  s.samples = audio_base[reg_samples];
+  s.callback = audio_play;
+  s.userdata = NULL;
+  int ret = SDL_OpenAudio(&s, NULL);
+  if (ret != 0) {
+    Log("Can not open audio: %s, and the stream is dropped", SDL_GetError());
+    dropping = true;
+    return;
+  }
+  SDL_PauseAudio(0);
+#endif
+}
+
 static void audio_io_handler(uint32_t offset, int len, bool is_write) {
+  switch (offset / sizeof(uint32_t)) {
+    case reg_init:
+      if (is_write && audio_base[reg_init]) audio_open();
+      break;
+    case reg_count:
+      if (is_write) audio_produce(audio_base[reg_count]);
+      else audio_base[reg_count] = count_seen = audio_count();
+      break;
+    default: break;
+  }
+}
+
+void audio_statistic() {
+  uint64_t n = nr_consume_total + atomic_load(&nr_consume) - nr_drop;
+  if (nr_drop > 0) Log("audio: %" PRIu64 " bytes dropped", nr_drop);
+  if (n == 0) return;
+  Log("audio: %" PRIu64 " bytes played, %" PRIu64 " underruns, %" PRIu64 " overruns",
+      n, atomic_load(&nr_underrun), nr_overrun);
+  IFDEF(CONFIG_AUDIO_WAV, Log("audio: %" PRIu64 " bytes written to %s, %" PRIu64 " stalls on the writer",
+      wav_nr_byte, CONFIG_AUDIO_WAV_FILE, wav_nr_stall));
 }
 
 void init_audio() {
   uint32_t space_size = sizeof(uint32_t) * nr_reg;
   audio_base = (uint32_t *)new_space(space_size);
+  audio_base[reg_sbuf_size] = CONFIG_SB_SIZE;
 #ifdef CONFIG_HAS_PORT_IO
   add_pio_map ("audio", CONFIG_AUDIO_CTL_PORT, audio_base, space_size, audio_io_handler);
 #else
@@ -44,4 +294,5 @@ void init_audio() {
 
   sbuf = (uint8_t *)new_space(CONFIG_SB_SIZE);
   add_mmio_map("audio-sbuf", CONFIG_SB_ADDR, sbuf, CONFIG_SB_SIZE, NULL);
+  MUXDEF(CONFIG_AUDIO_WAV, init_wav(), SDL_InitSubSystem(SDL_INIT_AUDIO));
 }
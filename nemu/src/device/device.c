@@ -15,7 +15,7 @@
 
 #include <common.h>
 #include <utils.h>
-#include <device/alarm.h>
+#include <device/event.h>
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 #endif
@@ -28,27 +28,41 @@ void init_i8042();
 void init_audio();
 void init_disk();
 void init_sdcard();
-void init_alarm();
 
 void send_key(uint8_t, bool);
+void key_queue_clear();
 void vga_update_screen();
+void vga_statistic();
+void audio_statistic();
 
-void device_update() {
-  static uint64_t last = 0;
-  uint64_t now = get_time();
-  if (now - last < 1000000 / TIMER_HZ) {
-    return;
-  }
-  last = now;
+#ifndef CONFIG_TARGET_AM
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 
-  IFDEF(CONFIG_HAS_VGA, vga_update_screen());
+void vga_init_screen();
+void vga_render();
 
-#ifndef CONFIG_TARGET_AM
+// SDL is owned by a display thread, which renders the frames handed over
+// by the VGA, and polls the events of the window. Keys are sent to the
+// keyboard through a lock-free queue, and a request to quit is checked
+// by the CPU thread periodically, so that the CPU thread never waits
+// for the display thread.
+static pthread_t sdl_thread;
+static sem_t sdl_sem;
+static atomic_bool sdl_exit = false, sdl_quit = false;
+
+// wake up the display thread to render a new frame
+void sdl_wakeup() {
+  sem_post(&sdl_sem);
+}
+
+static void sdl_poll_event() {
   SDL_Event event;
   while (SDL_PollEvent(&event)) {
     switch (event.type) {
       case SDL_QUIT:
-        nemu_state.state = NEMU_QUIT;
+        atomic_store(&sdl_quit, true);
         break;
 #ifdef CONFIG_HAS_KEYBOARD
       // If a key was pressed
@@ -63,16 +77,55 @@ void device_update() {
       default: break;
     }
   }
-#endif
 }
 
+static void* sdl_loop(void *arg) {
+  IFDEF(CONFIG_VGA_SHOW_SCREEN, vga_init_screen());
+  while (!atomic_load(&sdl_exit)) {
+    // events are polled at least TIMER_HZ times per second
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    t.tv_nsec += 1000000000 / TIMER_HZ;
+    if (t.tv_nsec >= 1000000000) { t.tv_sec ++; t.tv_nsec -= 1000000000; }
+    sem_timedwait(&sdl_sem, &t);
+    IFDEF(CONFIG_VGA_SHOW_SCREEN, vga_render());
+    sdl_poll_event();
+  }
+  return NULL;
+}
+
+static void sdl_check_quit() {
+  if (atomic_exchange(&sdl_quit, false)) nemu_state.state = NEMU_QUIT;
+}
+
+static void exit_sdl_thread() {
+  atomic_store(&sdl_exit, true);
+  sem_post(&sdl_sem);
+  pthread_join(sdl_thread, NULL);
+}
+
+static void init_sdl_thread() {
+  int ret = sem_init(&sdl_sem, 0, 0);
+  assert(ret == 0);
+  ret = pthread_create(&sdl_thread, NULL, sdl_loop, NULL);
+  assert(ret == 0);
+  atexit(exit_sdl_thread);
+}
+#endif
+
+// forget the requests to quit and the keys from the window while sdb is waiting
 void sdl_clear_event_queue() {
 #ifndef CONFIG_TARGET_AM
-  SDL_Event event;
-  while (SDL_PollEvent(&event));
+  atomic_store(&sdl_quit, false);
+  IFDEF(CONFIG_HAS_KEYBOARD, key_queue_clear());
 #endif
 }
 
+void device_statistic() {
+  IFDEF(CONFIG_HAS_VGA, vga_statistic());
+  IFDEF(CONFIG_HAS_AUDIO, audio_statistic());
+}
+
 void init_device() {
   IFDEF(CONFIG_TARGET_AM, ioe_init());
   init_map();
@@ -85,5 +138,7 @@ void init_device() {
   IFDEF(CONFIG_HAS_DISK, init_disk());
   IFDEF(CONFIG_HAS_SDCARD, init_sdcard());
 
-  IFNDEF(CONFIG_TARGET_AM, init_alarm());
+  IFDEF(CONFIG_HAS_VGA, add_event("vga", 1000000 / TIMER_HZ, vga_update_screen));
+  IFNDEF(CONFIG_TARGET_AM, add_event("sdl", 1000000 / TIMER_HZ, sdl_check_quit));
+  IFNDEF(CONFIG_TARGET_AM, init_sdl_thread());
 }
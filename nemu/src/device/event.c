@@ -0,0 +1,117 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <utils.h>
+#include <device/event.h>
+
+#define MAX_EVENT 16
+// bounds of the distance between two checkpoints without icount, in instructions
+#define MIN_CHECK_INST 1024
+#define MAX_CHECK_INST (1 << 20)
+
+typedef struct {
+  const char *name;
+  uint64_t period;
+  uint64_t deadline; // unit: us
+  event_handler_t handler;
+  int id;
+} Event;
+
+static Event events[MAX_EVENT] = {};
+// min-heap of events ordered by deadline, and then by the order of registration
+static Event *heap[MAX_EVENT] = {};
+static int nr_event = 0;
+
+uint64_t g_event_inst = 0;
+#ifndef CONFIG_ICOUNT
+// the time and the instruction count of the last checkpoint, which
+// are used to estimate how many instructions are run in 1 us
+static uint64_t last_time = 0, last_inst = 0;
+static uint64_t inst_per_us = 1;
+#endif
+
+static bool before(Event *a, Event *b) {
+  return a->deadline < b->deadline || (a->deadline == b->deadline && a->id < b->id);
+}
+
+static void swap(int i, int j) {
+  Event *t = heap[i];
+  heap[i] = heap[j];
+  heap[j] = t;
+}
+
+static void sift_up(int i) {
+  for (; i > 0 && before(heap[i], heap[(i - 1) / 2]); i = (i - 1) / 2) {
+    swap(i, (i - 1) / 2);
+  }
+}
+
+static void sift_down(int i) {
+  while (true) {
+    int min = i, l = 2 * i + 1, r = 2 * i + 2;
+    if (l < nr_event && before(heap[l], heap[min])) min = l;
+    if (r < nr_event && before(heap[r], heap[min])) min = r;
+    if (min == i) return;
+    swap(i, min);
+    i = min;
+  }
+}
+
+void add_event(const char *name, uint64_t period, event_handler_t handler) {
+  Assert(nr_event < MAX_EVENT, "too many events");
+  Assert(period > 0, "the period of event '%s' should not be 0", name);
+  Event *e = &events[nr_event];
+  *e = (Event) { .name = name, .period = period, .deadline = get_guest_time() + period,
+    .handler = handler, .id = nr_event };
+  heap[nr_event] = e;
+  sift_up(nr_event ++);
+  g_event_inst = 0;
+}
+
+// Run the events which are due, and set the next checkpoint around
+// the deadline of the earliest event, or exactly at it with icount.
+void event_run() {
+  uint64_t now = get_guest_time();
+#ifndef CONFIG_ICOUNT
+  if (now > last_time) {
+    uint64_t rate = (g_nr_guest_inst - last_inst) / (now - last_time);
+    inst_per_us = (rate > 0 ? rate : 1);
+  }
+  last_time = now;
+  last_inst = g_nr_guest_inst;
+#endif
+
+  while (nr_event > 0 && heap[0]->deadline <= now) {
+    Event *e = heap[0];
+    e->deadline += e->period;
+    // do not try to catch up if the host falls far behind
+    if (e->deadline <= now) e->deadline = now + e->period;
+    sift_down(0);
+    e->handler();
+  }
+
+#ifdef CONFIG_ICOUNT
+  // the earliest event is due exactly when the guest time reaches its deadline
+  g_event_inst = (nr_event > 0 ? heap[0]->deadline * CONFIG_ICOUNT_MIPS : UINT64_MAX);
+#else
+  uint64_t n = MAX_CHECK_INST;
+  if (nr_event > 0 && (heap[0]->deadline - now) < MAX_CHECK_INST / inst_per_us) {
+    n = (heap[0]->deadline - now) * inst_per_us;
+  }
+  if (n < MIN_CHECK_INST) n = MIN_CHECK_INST;
+  g_event_inst = g_nr_guest_inst + n;
+#endif
+}
@@ -32,22 +32,69 @@ uint8_t* new_space(int size) {
   return p;
 }
 
+// the map found in the table always contains `addr`
 static void check_bound(IOMap *map, paddr_t addr) {
-  if (map == NULL) {
-    Assert(map != NULL, "address (" FMT_PADDR ") is out of bound at pc = " FMT_WORD, addr, cpu.pc);
-  } else {
-    Assert(addr <= map->high && addr >= map->low,
-        "address (" FMT_PADDR ") is out of bound {%s} [" FMT_PADDR ", " FMT_PADDR "] at pc = " FMT_WORD,
-        addr, map->name, map->low, map->high, cpu.pc);
-  }
+  Assert(map != NULL, "address (" FMT_PADDR ") is out of bound at pc = " FMT_WORD, addr, cpu.pc);
 }
 
 static void invoke_callback(io_callback_t c, paddr_t offset, int len, bool is_write) {
   if (c != NULL) { c(offset, len, is_write); }
 }
 
+static IOPage* io_table_page(IOTable *t, paddr_t addr) {
+  IOPage **dir = &t->dir[(uint32_t)addr >> IO_DIR_SHIFT];
+  if (*dir == NULL) {
+    *dir = calloc(IO_NR_DIR_PAGE, sizeof(IOPage));
+    assert(*dir);
+  }
+  return &(*dir)[(addr >> PAGE_SHIFT) & (IO_NR_DIR_PAGE - 1)];
+}
+
+static void report_overlap(IOTable *t, IOMap *map, IOMap *old) {
+  panic("%s region %s@[" FMT_PADDR ", " FMT_PADDR "] is overlapped "
+               "with %s@[" FMT_PADDR ", " FMT_PADDR "]", t->name,
+               map->name, map->low, map->high, old->name, old->low, old->high);
+}
+
+void io_table_add(IOTable *t, const char *name, paddr_t addr,
+    void *space, uint32_t len, io_callback_t callback) {
+  paddr_t left = addr, right = addr + len - 1;
+  assert(len > 0 && right >= left);
+  IFDEF(PMEM64, assert((right >> 32) == 0));
+
+  IOMap *map = malloc(sizeof(IOMap));
+  assert(map);
+  *map = (IOMap){ .name = name, .low = left, .high = right,
+    .space = space, .callback = callback };
+  if (callback == NULL) {
+    map->dirty = calloc((right >> PAGE_SHIFT) - (left >> PAGE_SHIFT) + 1, 1);
+    assert(map->dirty);
+  }
+
+  for (paddr_t page = left & ~PAGE_MASK; ; page += PAGE_SIZE) {
+    IOPage *p = io_table_page(t, page);
+    if (p->map != NULL) report_overlap(t, map, p->map);
+    paddr_t l = (page > left ? page : left);
+    paddr_t r = (page + PAGE_MASK < right ? page + PAGE_MASK : right);
+    if (l == page && r == page + PAGE_MASK && p->sub == NULL) p->map = map;
+    else {
+      if (p->sub == NULL) {
+        p->sub = calloc(PAGE_SIZE, sizeof(IOMap *));
+        assert(p->sub);
+      }
+      for (uint32_t i = l & PAGE_MASK; i <= (r & PAGE_MASK); i ++) {
+        if (p->sub[i] != NULL) report_overlap(t, map, p->sub[i]);
+        p->sub[i] = map;
+      }
+    }
+    if (r == right) break;
+  }
+
+  Log("Add %s map '%s' at [" FMT_PADDR ", " FMT_PADDR "]", t->name, map->name, map->low, map->high);
+}
+
 void init_map() {
-  io_space = malloc(IO_SPACE_MAX);
+  io_space = MUXDEF(CONFIG_PMEM_MMAP, host_map("io space", IO_SPACE_MAX, true), malloc(IO_SPACE_MAX));
   assert(io_space);
   p_space = io_space;
 }
@@ -55,6 +102,7 @@ void init_map() {
 word_t map_read(paddr_t addr, int len, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
+  difftest_skip_ref();
   paddr_t offset = addr - map->low;
   invoke_callback(map->callback, offset, len, false); // prepare data to read
   word_t ret = host_read(map->space + offset, len);
@@ -64,7 +112,12 @@ word_t map_read(paddr_t addr, int len, IOMap *map) {
 void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
+  difftest_skip_ref();
   paddr_t offset = addr - map->low;
   host_write(map->space + offset, len, data);
+  if (map->dirty != NULL) {
+    *map_dirty_flag(map, addr) = 1;
+    *map_dirty_flag(map, addr + len - 1) = 1;
+  }
   invoke_callback(map->callback, offset, len, true);
 }
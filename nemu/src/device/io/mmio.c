@@ -15,49 +15,73 @@
 
 #include <device/map.h>
 #include <memory/paddr.h>
+#include <memory/pma.h>
 
-#define NR_MAP 16
-
-static IOMap maps[NR_MAP] = {};
-static int nr_map = 0;
-
-static IOMap* fetch_mmio_map(paddr_t addr) {
-  int mapid = find_mapid_by_addr(maps, nr_map, addr);
-  return (mapid == -1 ? NULL : &maps[mapid]);
-}
-
-static void report_mmio_overlap(const char *name1, paddr_t l1, paddr_t r1,
-    const char *name2, paddr_t l2, paddr_t r2) {
-  panic("MMIO region %s@[" FMT_PADDR ", " FMT_PADDR "] is overlapped "
-               "with %s@[" FMT_PADDR ", " FMT_PADDR "]", name1, l1, r1, name2, l2, r2);
-}
+static IOTable table = { .name = "mmio" };
 
 /* device interface */
 void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_callback_t callback) {
-  assert(nr_map < NR_MAP);
-  paddr_t left = addr, right = addr + len - 1;
-  if (in_pmem(left) || in_pmem(right)) {
-    report_mmio_overlap(name, left, right, "pmem", PMEM_LEFT, PMEM_RIGHT);
-  }
-  for (int i = 0; i < nr_map; i++) {
-    if (left <= maps[i].high && right >= maps[i].low) {
-      report_mmio_overlap(name, left, right, maps[i].name, maps[i].low, maps[i].high);
+  // overlapping with pmem and other regions is reported by the table
+  pma_add(name, PMA_MMIO, addr, len, NULL);
+  io_table_add(&table, name, addr, space, len, callback);
+}
+
+void mmio_fetch_dirty_ranges(paddr_t addr, uint32_t len,
+    void (*f)(paddr_t addr, uint32_t len, void *arg), void *arg) {
+  bool dirty = false;
+  paddr_t end = addr + len - 1;
+  paddr_t page = addr & ~PAGE_MASK, last = end & ~PAGE_MASK;
+  paddr_t start = 0;  // the start of the current range of dirty pages
+  bool in_range = false;
+  for (; ; page += PAGE_SIZE) {
+    paddr_t l = (page > addr ? page : addr);
+    IOMap *map = io_table_find(&table, l);
+    bool d = false;
+    if (map != NULL && map->dirty != NULL) {
+      uint8_t *flag = map_dirty_flag(map, page);
+      d = *flag;
+      *flag = 0;
     }
+    if (d && !in_range) { start = l; in_range = true; }
+    if (!d && in_range) { f(start, l - start, arg); in_range = false; }
+    dirty |= d;
+    if (page == last) break;
   }
+  if (in_range) f(start, end - start + 1, arg);
+  // the TLB may allow direct stores to the pages which are clean now
+  if (dirty) tlb_flush();
+}
 
-  maps[nr_map] = (IOMap){ .name = name, .low = addr, .high = addr + len - 1,
-    .space = space, .callback = callback };
-  Log("Add mmio map '%s' at [" FMT_PADDR ", " FMT_PADDR "]",
-      maps[nr_map].name, maps[nr_map].low, maps[nr_map].high);
+static void set_dirty(paddr_t addr, uint32_t len, void *arg) {
+  *(bool *)arg = true;
+}
 
-  nr_map ++;
+bool mmio_fetch_dirty(paddr_t addr, uint32_t len) {
+  bool dirty = false;
+  mmio_fetch_dirty_ranges(addr, len, set_dirty, &dirty);
+  return dirty;
 }
 
 /* bus interface */
 word_t mmio_read(paddr_t addr, int len) {
-  return map_read(addr, len, fetch_mmio_map(addr));
+  return map_read(addr, len, io_table_find(&table, addr));
 }
 
 void mmio_write(paddr_t addr, int len, word_t data) {
-  map_write(addr, len, data, fetch_mmio_map(addr));
+  map_write(addr, len, data, io_table_find(&table, addr));
+}
+
+// Return the host address of `page` if it is entirely inside a map
+// without callback, so that it can be accessed like memory. A page is
+// regarded as dirty once it is allowed to be written directly.
+// While difftest is attached, every MMIO access goes through map_read()
+// and map_write() so that the reference design skips it.
+uint8_t* mmio_direct_page(paddr_t page, bool is_write) {
+  if (difftest_is_attached()) return NULL;
+  IOMap *map = io_table_find(&table, page);
+  if (map == NULL || map->dirty == NULL || page < map->low || page + PAGE_MASK > map->high) {
+    return NULL;
+  }
+  if (is_write) *map_dirty_flag(map, page) = 1;
+  return (uint8_t *)map->space + (page - map->low);
 }
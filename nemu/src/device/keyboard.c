@@ -20,6 +20,7 @@
 
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
+#include <stdatomic.h>
 
 // Note that this is not the standard
 #define NEMU_KEYS(f) \
@@ -45,25 +46,36 @@ static void init_keymap() {
   MAP(NEMU_KEYS, SDL_KEYMAP)
 }
 
+// Keys are enqueued by the display thread, and dequeued by the CPU thread.
 #define KEY_QUEUE_LEN 1024
 static int key_queue[KEY_QUEUE_LEN] = {};
-static int key_f = 0, key_r = 0;
+static _Atomic int key_f = 0, key_r = 0;
 
 static void key_enqueue(uint32_t am_scancode) {
-  key_queue[key_r] = am_scancode;
-  key_r = (key_r + 1) % KEY_QUEUE_LEN;
-  Assert(key_r != key_f, "key queue overflow!");
+  int r = atomic_load_explicit(&key_r, memory_order_relaxed);
+  int next = (r + 1) % KEY_QUEUE_LEN;
+  // the key is lost if the guest does not read the queue
+  if (next == atomic_load_explicit(&key_f, memory_order_acquire)) return;
+  key_queue[r] = am_scancode;
+  atomic_store_explicit(&key_r, next, memory_order_release);
 }
 
 static uint32_t key_dequeue() {
   uint32_t key = NEMU_KEY_NONE;
-  if (key_f != key_r) {
-    key = key_queue[key_f];
-    key_f = (key_f + 1) % KEY_QUEUE_LEN;
+  int f = atomic_load_explicit(&key_f, memory_order_relaxed);
+  if (f != atomic_load_explicit(&key_r, memory_order_acquire)) {
+    key = key_queue[f];
+    atomic_store_explicit(&key_f, (f + 1) % KEY_QUEUE_LEN, memory_order_release);
   }
   return key;
 }
 
+// drop the keys pressed while sdb is waiting, called by the CPU thread
+void key_queue_clear() {
+  atomic_store_explicit(&key_f, atomic_load_explicit(&key_r, memory_order_acquire),
+      memory_order_release);
+}
+
 void send_key(uint8_t scancode, bool is_keydown) {
   if (nemu_state.state == NEMU_RUNNING && keymap[scancode] != NEMU_KEY_NONE) {
     uint32_t am_scancode = keymap[scancode] | (is_keydown ? KEYDOWN_MASK : 0);
@@ -14,7 +14,7 @@
 ***************************************************************************************/
 
 #include <device/map.h>
-#include <device/alarm.h>
+#include <device/event.h>
 #include <utils.h>
 
 static uint32_t *rtc_port_base = NULL;
@@ -22,7 +22,7 @@ static uint32_t *rtc_port_base = NULL;
 static void rtc_io_handler(uint32_t offset, int len, bool is_write) {
   assert(offset == 0 || offset == 4);
   if (!is_write && offset == 4) {
-    uint64_t us = get_time();
+    uint64_t us = get_guest_time();
     rtc_port_base[0] = (uint32_t)us;
     rtc_port_base[1] = us >> 32;
   }
@@ -44,5 +44,5 @@ void init_timer() {
 #else
   add_mmio_map("rtc", CONFIG_RTC_MMIO, rtc_port_base, 8, rtc_io_handler);
 #endif
-  IFNDEF(CONFIG_TARGET_AM, add_alarm_handle(timer_intr));
+  IFNDEF(CONFIG_TARGET_AM, add_event("timer", 1000000 / TIMER_HZ, timer_intr));
 }
@@ -0,0 +1,158 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <utils.h>
+
+// Frames synced by the guest are copied into the slots of an
+// asynchronous writer, and converted to the output format by the writer
+// thread. A frame whose vmem is not written since the previous dumped
+// frame is not copied, and the previous output is repeated instead.
+
+#define NR_SLOT 8
+
+typedef struct {
+  uint64_t index;
+  bool repeat;
+  uint32_t pixel[];
+} Frame;
+
+static FILE *dump_fp = NULL;
+static AsyncWriter *writer = NULL;
+static int width = 0, height = 0;
+static uint64_t nr_sync = 0, nr_dump = 0, nr_repeat = 0, nr_drop = 0;
+// vmem is changed since the last frame in the dump
+static bool changed = true;
+
+#ifndef CONFIG_VGA_DUMP_HASH
+// the output of the last frame, only accessed by the writer thread
+static uint8_t *out = NULL;
+static size_t out_len = 0;
+
+static void write_output(FILE *fp, Frame *f) {
+  fwrite(out, out_len, 1, fp);
+}
+#endif
+
+#if defined(CONFIG_VGA_DUMP_Y4M)
+static void write_header(FILE *fp) {
+  fprintf(fp, "YUV4MPEG2 W%d H%d F60:%d Ip A1:1 C444\n", width, height, CONFIG_VGA_DUMP_STRIDE);
+}
+
+// BT.601 with limited range
+static void convert(Frame *f) {
+  int n = width * height;
+  uint8_t *y = out + 6, *u = y + n, *v = u + n;
+  for (int i = 0; i < n; i ++) {
+    int r = (f->pixel[i] >> 16) & 0xff, g = (f->pixel[i] >> 8) & 0xff, b = f->pixel[i] & 0xff;
+    y[i] = ((  66 * r + 129 * g +  25 * b + 128) >> 8) + 16;
+    u[i] = (( -38 * r -  74 * g + 112 * b + 128) >> 8) + 128;
+    v[i] = (( 112 * r -  94 * g -  18 * b + 128) >> 8) + 128;
+  }
+}
+
+static void init_output() {
+  out_len = 6 + width * height * 3;
+  out = malloc(out_len);
+  memcpy(out, "FRAME\n", 6);
+}
+#elif defined(CONFIG_VGA_DUMP_PPM)
+static void write_header(FILE *fp) { }
+
+static int ppm_header_len = 0;
+
+static void convert(Frame *f) {
+  uint8_t *p = out + ppm_header_len;
+  for (int i = 0; i < width * height; i ++) {
+    *p ++ = f->pixel[i] >> 16;
+    *p ++ = f->pixel[i] >> 8;
+    *p ++ = f->pixel[i];
+  }
+}
+
+static void init_output() {
+  char header[32];
+  ppm_header_len = sprintf(header, "P6\n%d %d\n255\n", width, height);
+  out_len = ppm_header_len + width * height * 3;
+  out = malloc(out_len);
+  memcpy(out, header, ppm_header_len);
+}
+#else
+static void write_header(FILE *fp) { }
+
+static uint64_t out_hash = 0;
+
+// FNV-1a
+static void convert(Frame *f) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (int i = 0; i < width * height; i ++) {
+    h ^= f->pixel[i];
+    h *= 0x100000001b3ull;
+  }
+  out_hash = h;
+}
+
+static void write_output(FILE *fp, Frame *f) {
+  fprintf(fp, "%" PRIu64 " %016" PRIx64 "\n", f->index, out_hash);
+}
+
+static void init_output() { }
+#endif
+
+static void write_frame(FILE *fp, void *slot, size_t len, void *arg) {
+  Frame *f = slot;
+  if (!f->repeat) convert(f);
+  write_output(fp, f);
+}
+
+void vga_dump_frame(const uint32_t *vmem, bool dirty) {
+  changed |= dirty;
+  if (nr_sync ++ % CONFIG_VGA_DUMP_STRIDE != 0) return;
+  Frame *f = writer_acquire(writer);
+  if (f == NULL) { nr_drop ++; return; }
+  f->index = nr_sync - 1;
+  f->repeat = !changed;
+  size_t len = sizeof(Frame);
+  if (changed) {
+    len += width * height * sizeof(uint32_t);
+    memcpy(f->pixel, vmem, len - sizeof(Frame));
+    changed = false;
+  } else nr_repeat ++;
+  writer_commit(writer, len);
+  nr_dump ++;
+}
+
+void vga_dump_statistic() {
+  Log("vga dump: %" PRIu64 " frames synced, %" PRIu64 " dumped (%" PRIu64 " unchanged), %" PRIu64 " dropped",
+      nr_sync, nr_dump, nr_repeat, nr_drop);
+}
+
+static void close_dump() {
+  writer_close(writer);
+  fclose(dump_fp);
+  IFNDEF(CONFIG_VGA_DUMP_HASH, free(out));
+}
+
+void init_vga_dump(int w, int h) {
+  width = w;
+  height = h;
+  dump_fp = fopen(CONFIG_VGA_DUMP_FILE, "wb");
+  Assert(dump_fp, "Can not open '%s'", CONFIG_VGA_DUMP_FILE);
+  write_header(dump_fp);
+  init_output();
+  writer = writer_open(dump_fp, NR_SLOT, sizeof(Frame) + w * h * sizeof(uint32_t), write_frame, NULL);
+  atexit(close_dump);
+  Log("VGA frames are written to %s", CONFIG_VGA_DUMP_FILE);
+}
@@ -35,13 +35,31 @@ static void *vmem = NULL;
 static uint32_t *vgactl_port_base = NULL;
 
 #ifdef CONFIG_VGA_SHOW_SCREEN
+// rows written by the guest since they were last handed over to the renderer
+static bool *row_dirty = NULL;
+// rows of `frame` which are waiting to be uploaded by the renderer
+static bool *row_upload = NULL;
+// the frame seen by the renderer
+static uint32_t *frame = NULL;
+static bool frame_deferred = false;
+static uint64_t nr_frame = 0, nr_upload_byte = 0, nr_defer = 0;
+
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
+#include <stdatomic.h>
+
+// The renderer runs in the display thread, which owns SDL. The frame
+// is a snapshot of vmem, which is owned by the renderer as long as it
+// is pending, so that the guest never waits for the renderer.
+static atomic_bool frame_pending = false;
+
+void sdl_wakeup();
 
 static SDL_Renderer *renderer = NULL;
 static SDL_Texture *texture = NULL;
 
-static void init_screen() {
+// called by the display thread
+void vga_init_screen() {
   SDL_Window *window = NULL;
   char title[128];
   sprintf(title, "%s-NEMU", str(__GUEST_ISA__));
@@ -53,27 +71,141 @@ static void init_screen() {
   SDL_SetWindowTitle(window, title);
   texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
       SDL_TEXTUREACCESS_STATIC, SCREEN_W, SCREEN_H);
-  SDL_RenderPresent(renderer);
 }
 
-static inline void update_screen() {
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(uint32_t));
+static inline void upload_rows(int y, int h) {
+  SDL_Rect rect = { .x = 0, .y = y, .w = SCREEN_W, .h = h };
+  SDL_UpdateTexture(texture, &rect, frame + y * SCREEN_W, SCREEN_W * sizeof(uint32_t));
+}
+
+static inline void present_screen() {
   SDL_RenderClear(renderer);
   SDL_RenderCopy(renderer, texture, NULL, NULL);
   SDL_RenderPresent(renderer);
 }
 #else
-static void init_screen() {}
+static inline void upload_rows(int y, int h) {
+  io_write(AM_GPU_FBDRAW, 0, y, frame + y * screen_width(), screen_width(), h, false);
+}
+
+static inline void present_screen() {
+  io_write(AM_GPU_FBDRAW, 0, 0, NULL, 0, 0, true);
+}
+#endif
 
-static inline void update_screen() {
-  io_write(AM_GPU_FBDRAW, 0, 0, vmem, screen_width(), screen_height(), true);
+// Upload the rows in `row_upload` by bands of adjacent rows.
+static void render() {
+  uint32_t h = screen_height();
+  for (uint32_t y = 0; y < h; ) {
+    if (!row_upload[y]) { y ++; continue; }
+    uint32_t y0 = y;
+    while (y < h && row_upload[y]) row_upload[y ++] = false;
+    upload_rows(y0, y - y0);
+  }
+  present_screen();
 }
+
+#ifndef CONFIG_TARGET_AM
+// called by the display thread
+void vga_render() {
+  if (!atomic_load_explicit(&frame_pending, memory_order_acquire)) return;
+  render();
+  atomic_store_explicit(&frame_pending, false, memory_order_release);
+}
+#endif
+
+// Hand the dirty rows over to the renderer. If it is still busy with
+// the previous frame, they are handed over at the next refresh instead.
+static void hand_over() {
+#ifndef CONFIG_TARGET_AM
+  if (atomic_load_explicit(&frame_pending, memory_order_acquire)) {
+    if (!frame_deferred) nr_defer ++;
+    frame_deferred = true;
+    return;
+  }
 #endif
+  frame_deferred = false;
+  uint32_t w = screen_width(), h = screen_height();
+  for (uint32_t y = 0; y < h; y ++) {
+    if (!row_dirty[y]) continue;
+    IFNDEF(CONFIG_TARGET_AM, memcpy(frame + y * w, (uint32_t *)vmem + y * w, w * sizeof(uint32_t)));
+    row_upload[y] = true;
+    row_dirty[y] = false;
+    nr_upload_byte += w * sizeof(uint32_t);
+  }
+  nr_frame ++;
+#ifdef CONFIG_TARGET_AM
+  render();
+#else
+  atomic_store_explicit(&frame_pending, true, memory_order_release);
+  sdl_wakeup();
 #endif
+}
+
+static void mark_dirty_range(paddr_t addr, uint32_t len, void *arg) {
+  uint32_t pitch = screen_width() * sizeof(uint32_t);
+  uint32_t y0 = (addr - CONFIG_FB_ADDR) / pitch;
+  uint32_t y1 = (addr - CONFIG_FB_ADDR + len - 1) / pitch + 1;
+  memset(row_dirty + y0, true, y1 - y0);
+  *(bool *)arg = true;
+}
+
+// Only the rows covered by the pages of vmem written since the previous
+// update are handed over. Return whether any page is written.
+static bool update_screen() {
+  bool dirty = false;
+  mmio_fetch_dirty_ranges(CONFIG_FB_ADDR, screen_size(), mark_dirty_range, &dirty);
+  hand_over();
+  return dirty;
+}
+
+static void init_screen() {
+  uint32_t h = screen_height();
+  row_dirty = calloc(h, sizeof(bool));
+  row_upload = malloc(h * sizeof(bool));
+  memset(row_upload, true, h);
+#ifdef CONFIG_TARGET_AM
+  frame = vmem;
+  render();
+#else
+  frame = calloc(1, screen_size());
+  // the display thread starts with a full frame
+  atomic_store(&frame_pending, true);
+#endif
+}
+
+static void screen_statistic() {
+  if (nr_frame == 0) return;
+  Log("vga: %" PRIu64 " frames, %" PRIu64 " bytes uploaded, %" PRIu64 " bytes per frame (full frame: %u bytes), "
+      "%" PRIu64 " frames deferred", nr_frame, nr_upload_byte, nr_upload_byte / nr_frame, screen_size(), nr_defer);
+}
+#endif
+
+#ifdef CONFIG_VGA_DUMP
+void init_vga_dump(int w, int h);
+void vga_dump_frame(const uint32_t *vmem, bool dirty);
+void vga_dump_statistic();
+#endif
+
+void vga_statistic() {
+  IFDEF(CONFIG_VGA_SHOW_SCREEN, screen_statistic());
+  IFDEF(CONFIG_VGA_DUMP, vga_dump_statistic());
+}
 
 void vga_update_screen() {
-  // TODO: call `update_screen()` when the sync register is non-zero,
-  // then zero out the sync register
+  // the guest sets the sync register after a frame is drawn
+  if (vgactl_port_base[1] == 0) {
+    IFDEF(CONFIG_VGA_SHOW_SCREEN, if (frame_deferred) hand_over());
+    return;
+  }
+#ifdef CONFIG_VGA_DUMP
+  bool dirty = MUXDEF(CONFIG_VGA_SHOW_SCREEN, update_screen(),
+      mmio_fetch_dirty(CONFIG_FB_ADDR, screen_size()));
+  vga_dump_frame(vmem, dirty);
+#else
+  IFDEF(CONFIG_VGA_SHOW_SCREEN, update_screen());
+#endif
+  vgactl_port_base[1] = 0;
 }
 
 void init_vga() {
@@ -87,6 +219,8 @@ void init_vga() {
 
   vmem = new_space(screen_size());
   add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
   IFDEF(CONFIG_VGA_SHOW_SCREEN, memset(vmem, 0, screen_size()));
+  IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
+  IFDEF(CONFIG_VGA_DUMP, memset(vmem, 0, screen_size()));
+  IFDEF(CONFIG_VGA_DUMP, init_vga_dump(screen_width(), screen_height()));
 }
@@ -17,6 +17,7 @@ SRCS-y += src/nemu-main.c
 DIRS-y += src/cpu src/monitor src/utils
 DIRS-$(CONFIG_MODE_SYSTEM) += src/memory
 DIRS-BLACKLIST-$(CONFIG_TARGET_AM) += src/monitor/sdb
+SRCS-BLACKLIST-$(CONFIG_TARGET_AM) += src/monitor/elf.c
 
 SHARE = $(if $(CONFIG_TARGET_SHARE),1,0)
 LIBS += $(if $(CONFIG_TARGET_NATIVE_ELF),-lreadline -ldl -pie,)
@@ -26,3 +27,15 @@ ASFLAGS += -DBIN_PATH=\"$(mainargs)\"
 endif
 SRCS-$(CONFIG_TARGET_AM) += src/am-bin.S
 .PHONY: src/am-bin.S
+
+ifndef CONFIG_PMEM_MMAP
+SRCS-BLACKLIST-y += src/memory/host.c
+endif
+
+ifndef CONFIG_DECODE_CACHE
+SRCS-BLACKLIST-y += src/cpu/decode-cache.c
+endif
+
+ifndef CONFIG_BLOCK_CACHE
+SRCS-BLACKLIST-y += src/cpu/block-cache.c
+endif
@@ -15,3 +15,28 @@
 
 INC_PATH += $(NEMU_HOME)/src/isa/$(GUEST_ISA)/include
 DIRS-y += src/isa/$(GUEST_ISA)
+
+ifndef CONFIG_ENGINE_JIT
+SRCS-BLACKLIST-y += src/isa/$(GUEST_ISA)/jit.c
+endif
+
+ifdef CONFIG_ISA_riscv
+# keys of the decode tree: opcode, funct3 and funct7
+DECODE_KEYS = 6:0 14:12 31:25
+endif
+
+ifneq ($(DECODE_KEYS),)
+GEN_DECODE_PATH := $(NEMU_HOME)/tools/gen-decode
+GEN_DECODE := $(GEN_DECODE_PATH)/build/gen-decode
+DECODE_TREE := $(NEMU_HOME)/include/generated/decode-$(GUEST_ISA).h
+GEN_HEADERS += $(DECODE_TREE)
+
+$(GEN_DECODE):
+	$(Q)$(MAKE) $(silent) -C $(GEN_DECODE_PATH)
+
+$(DECODE_TREE): src/isa/$(GUEST_ISA)/inst.c $(GEN_DECODE)
+	@echo + GEN $@
+	@mkdir -p $(dir $@)
+	@$(GEN_DECODE) $< $(DECODE_KEYS) > $@.tmp
+	@mv $@.tmp $@
+endif
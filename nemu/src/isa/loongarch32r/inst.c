@@ -19,8 +19,9 @@
 #include <cpu/decode.h>
 
 #define R(i) gpr(i)
-#define Mr vaddr_read
-#define Mw vaddr_write
+// the length is always a constant, so bind to the specialized access
+#define Mr(addr, len) concat(vaddr_read, MEM_BITS(len))(addr)
+#define Mw(addr, len, data) concat(vaddr_write, MEM_BITS(len))(addr, data)
 
 enum {
   TYPE_2RI12, TYPE_1RI20,
@@ -26,6 +26,8 @@ typedef struct {
 // decode
 typedef struct {
   uint32_t inst;
+  uint8_t rd, rs1, rs2;
+  word_t imm;
 } MUXDEF(CONFIG_RV64, riscv64_ISADecodeInfo, riscv32_ISADecodeInfo);
 
 #define isa_mmu_check(vaddr, len, type) (MMU_DIRECT)
@@ -17,27 +17,34 @@
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include <memory/paddr.h>
 
 #define R(i) gpr(i)
-#define Mr vaddr_read
-#define Mw vaddr_write
+// the length is always a constant, so bind to the specialized access
+#define Mr(addr, len) concat(vaddr_read, MEM_BITS(len))(addr)
+#define Mw(addr, len, data) concat(vaddr_write, MEM_BITS(len))(addr, data)
 
 enum {
   TYPE_I, TYPE_U, TYPE_S,
   TYPE_N, // none
 };
 
-#define src1R() do { *src1 = R(rs1); } while (0)
-#define src2R() do { *src2 = R(rs2); } while (0)
-#define immI() do { *imm = SEXT(BITS(i, 31, 20), 12); } while(0)
-#define immU() do { *imm = SEXT(BITS(i, 31, 12), 20) << 12; } while(0)
-#define immS() do { *imm = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7); } while(0)
+#define src1R() do { s->isa.rs1 = BITS(i, 19, 15); } while (0)
+#define src2R() do { s->isa.rs2 = BITS(i, 24, 20); } while (0)
+#define immI() do { s->isa.imm = SEXT(BITS(i, 31, 20), 12); } while(0)
+#define immU() do { s->isa.imm = SEXT(BITS(i, 31, 12), 20) << 12; } while(0)
+#define immS() do { s->isa.imm = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7); } while(0)
 
-static void decode_operand(Decode *s, int *rd, word_t *src1, word_t *src2, word_t *imm, int type) {
+// Unused source registers are decoded as $zero, so that the execution
+// helpers can read both of them unconditionally. The type is always a
+// constant, so the switch is resolved at compile time once inlined.
+__attribute__((always_inline))
+static inline void decode_operand(Decode *s, int type) {
   uint32_t i = s->isa.inst;
-  int rs1 = BITS(i, 19, 15);
-  int rs2 = BITS(i, 24, 20);
-  *rd     = BITS(i, 11, 7);
+  s->isa.rd  = BITS(i, 11, 7);
+  s->isa.rs1 = 0;
+  s->isa.rs2 = 0;
+  s->isa.imm = 0;
   switch (type) {
     case TYPE_I: src1R();          immI(); break;
     case TYPE_U:                   immU(); break;
@@ -47,32 +54,175 @@ static void decode_operand(Decode *s, int *rd, word_t *src1, word_t *src2, word_
   }
 }
 
-static int decode_exec(Decode *s) {
-  s->dnpc = s->snpc;
+// The instruction table is expanded into an execution helper for each
+// instruction. The patterns are also read by tools/gen-decode at build time
+// to generate a decode tree, which selects the helper by opcode, funct3 and
+// funct7 instead of trying the patterns one by one. The result of decoding
+// can then be cached and the helper can be called without decoding again.
+#define INSTPAT_TABLE(INSTPAT) \
+  INSTPAT("??????? ????? ????? ??? ????? 00101 11", auipc  , U, R(rd) = s->pc + imm) \
+  INSTPAT("??????? ????? ????? 100 ????? 00000 11", lbu    , I, R(rd) = Mr(src1 + imm, 1)) \
+  INSTPAT("??????? ????? ????? 000 ????? 01000 11", sb     , S, Mw(src1 + imm, 1, src2)) \
+  \
+  INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, NEMUTRAP(s->pc, R(10))) /* R(10) is $a0 */ \
+  INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv    , N, INV(s->pc))
 
+// Only the operands used by the type are read from the register file.
+#define SRC1_I R(s->isa.rs1)
+#define SRC1_U 0
+#define SRC1_S R(s->isa.rs1)
+#define SRC1_N 0
+#define SRC2_I 0
+#define SRC2_U 0
+#define SRC2_S R(s->isa.rs2)
+#define SRC2_N 0
+
+// Whether the instructions of the type write rd. If so, the helper for
+// rd != $zero never writes $zero, and can skip resetting it.
+#define HAS_RD_I 1
+#define HAS_RD_U 1
+#define HAS_RD_S 0
+#define HAS_RD_N 0
+// Whether the instructions of the type only write rd. If so, the
+// instruction does nothing when rd is $zero.
+#define ONLY_RD_I 0
+#define ONLY_RD_U 1
+#define ONLY_RD_S 0
+#define ONLY_RD_N 0
+
+#define EXEC_BODY(type, reset_zero, ... /* execute body */ ) { \
+  __attribute__((unused)) int rd = s->isa.rd; \
+  __attribute__((unused)) word_t src1 = concat(SRC1_, type), src2 = concat(SRC2_, type), imm = s->isa.imm; \
+  s->dnpc = s->snpc; \
+  __VA_ARGS__ ; \
+  if (reset_zero) R(0) = 0; /* reset $zero to 0 */ \
+}
+
+// Each instruction has a general helper, and a specialized one for rd != $zero.
+#define def_EHelper(pattern, name, type, ... /* execute body */ ) \
+static void concat(exec_, name)(Decode *s) EXEC_BODY(type, true, __VA_ARGS__) \
+static void concat3(exec_, name, _rd)(Decode *s) EXEC_BODY(type, false, __VA_ARGS__)
+
+static void exec_nop(Decode *s) { s->dnpc = s->snpc; }
+
+INSTPAT_TABLE(def_EHelper)
+
+#ifdef CONFIG_INST_FUSION
+// Pairs of instructions which are fused when the second one takes the
+// result of the first one as rs1, e.g. a pc-relative address followed by
+// a memory access. The fused helper is the two execution helpers inlined
+// one after another, so the architectural state after it is exactly the
+// same as executing the pair one by one. The first instruction should
+// not write memory, since the second one is not decoded again.
+#define FUSEPAT_TABLE(FUSEPAT) \
+  FUSEPAT(auipc, lbu) \
+  FUSEPAT(auipc, sb)
+
+#define def_FHelper(name1, name2) \
+static void concat4(exec_, name1, _, name2)(Decode *s) { \
+  concat(exec_, name1)(s); \
+  Decode next = { .pc = s->snpc, .snpc = s->snpc + 4, .isa = s->fused_isa }; \
+  concat(exec_, name2)(&next); \
+  s->dnpc = next.dnpc; \
+}
+
+FUSEPAT_TABLE(def_FHelper)
+#endif
+
+#ifdef CONFIG_THREADED_CODE
+#define def_INDEX(pattern, name, ...) concat(IDX_, name),
+enum { INSTPAT_TABLE(def_INDEX) };
+
+// labels of the handlers in isa_exec_threaded()
+static const void **handler_table = NULL;
+#endif
+
+static int decode(Decode *s) {
 #define INSTPAT_INST(s) ((s)->isa.inst)
 #define INSTPAT_MATCH(s, name, type, ... /* execute body */ ) { \
-  int rd = 0; \
-  word_t src1 = 0, src2 = 0, imm = 0; \
-  decode_operand(s, &rd, &src1, &src2, &imm, concat(TYPE_, type)); \
-  __VA_ARGS__ ; \
+  decode_operand(s, concat(TYPE_, type)); \
+  s->EHelper = (concat(HAS_RD_, type) && s->isa.rd != 0 ? concat3(exec_, name, _rd) : \
+      concat(ONLY_RD_, type) ? exec_nop : concat(exec_, name)); \
+  IFDEF(CONFIG_THREADED_CODE, s->handler = handler_table[concat(IDX_, name)]); \
 }
 
   INSTPAT_START();
-  INSTPAT("??????? ????? ????? ??? ????? 00101 11", auipc  , U, R(rd) = s->pc + imm);
-  INSTPAT("??????? ????? ????? 100 ????? 00000 11", lbu    , I, R(rd) = Mr(src1 + imm, 1));
-  INSTPAT("??????? ????? ????? 000 ????? 01000 11", sb     , S, Mw(src1 + imm, 1, src2));
-
-  INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, NEMUTRAP(s->pc, R(10))); // R(10) is $a0
-  INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv    , N, INV(s->pc));
+#include <generated/decode-riscv32.h>
   INSTPAT_END();
 
-  R(0) = 0; // reset $zero to 0
-
   return 0;
 }
 
-int isa_exec_once(Decode *s) {
+int isa_fetch_decode(Decode *s) {
   s->isa.inst = inst_fetch(&s->snpc, 4);
-  return decode_exec(s);
+  return decode(s);
+}
+
+int isa_exec_once(Decode *s) {
+  isa_fetch_decode(s);
+  s->EHelper(s);
+  return 0;
+}
+
+#ifdef CONFIG_THREADED_CODE
+// Execute at most `n` instructions from `pc` with direct-threaded code.
+// Every handler jumps to the handler of the next instruction, which is
+// taken from the decode cache. Return the number of executed instructions.
+uint64_t isa_exec_threaded(vaddr_t pc, uint64_t n) {
+#define def_LABEL(pattern, name, ...) [concat(IDX_, name)] = &&concat(do_, name),
+  static const void *table[] = { INSTPAT_TABLE(def_LABEL) };
+  // export the labels before any instruction is decoded
+  handler_table = table;
+
+  uint64_t nr = 0;
+  Decode *s = decode_cache_lookup(pc);
+  goto *s->handler;
+
+#define DISPATCH() do { \
+  cpu.pc = s->dnpc; \
+  if (unlikely(++ nr == n || nemu_state.state != NEMU_RUNNING)) return nr; \
+  s = decode_cache_lookup(cpu.pc); \
+  goto *s->handler; \
+} while (0)
+#define def_HANDLER(pattern, name, type, ... /* execute body */ ) \
+  concat(do_, name): EXEC_BODY(type, true, __VA_ARGS__) DISPATCH();
+
+  INSTPAT_TABLE(def_HANDLER)
+#undef DISPATCH
+}
+#endif
+
+#ifdef CONFIG_INST_FUSION
+// Try to fuse `s` with the next instruction. Only instructions
+// in the same page of pmem are fused, which is where the decode
+// cache tracks stores to the code.
+void isa_fuse_next(Decode *s) {
+  s->FHelper = NULL;
+  if (s->isa.rd == 0 || (s->snpc & PAGE_MASK) == 0 || !in_pmem(s->snpc)) return;
+
+  Decode next = { .pc = s->snpc, .snpc = s->snpc };
+  isa_fetch_decode(&next);
+  if (next.isa.rs1 != s->isa.rd) return;
+
+#define IS_INST(s, name) ((s)->EHelper == concat(exec_, name) || (s)->EHelper == concat3(exec_, name, _rd))
+#define FUSEPAT_MATCH(name1, name2) \
+  if (IS_INST(s, name1) && IS_INST(&next, name2)) { \
+    s->FHelper = concat4(exec_, name1, _, name2); \
+    s->fused_isa = next.isa; \
+    return; \
+  }
+  FUSEPAT_TABLE(FUSEPAT_MATCH)
+}
+#endif
+
+bool isa_is_block_end(Decode *s) {
+  switch (BITS(s->isa.inst, 6, 0)) {
+    case 0x63: // branch
+    case 0x67: // jalr
+    case 0x6f: // jal
+    case 0x0f: // fence, fence.i
+    case 0x73: // system
+      return true;
+  }
+  return s->EHelper == exec_inv;
 }
@@ -0,0 +1,315 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/decode.h>
+#include <cpu/difftest.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <stddef.h>
+
+#ifndef __x86_64__
+#error "the JIT only supports x86-64 hosts"
+#endif
+
+// Host registers which hold fixed values during the execution of a block.
+//   rbp: &cpu
+//   r15: the host address of CONFIG_MBASE
+//   rbx: the map of pages containing translated code, see block-cache.c
+// They are callee-saved, so they survive the calls to execution helpers.
+
+static uint8_t *p = NULL;
+
+static void emit8(uint8_t x) { *p ++ = x; }
+static void emit32(uint32_t x) { memcpy(p, &x, 4); p += 4; }
+static void emit64(uint64_t x) { memcpy(p, &x, 8); p += 8; }
+
+// emit a jcc/jmp with a 32-bit displacement, and return the position of
+// the displacement, which is patched later by `patch()`
+static uint8_t* emit_jcc(uint8_t cc) { emit8(0x0f); emit8(cc); emit32(0); return p - 4; }
+static uint8_t* emit_jmp() { emit8(0xe9); emit32(0); return p - 4; }
+static void patch(uint8_t *rel) { uint32_t off = p - (rel + 4); memcpy(rel, &off, 4); }
+#define JNE 0x85
+#define JAE 0x83
+
+#define GPR(i) ((uint32_t)(offsetof(CPU_state, gpr) + (i) * sizeof(word_t)))
+#define PC     ((uint32_t)offsetof(CPU_state, pc))
+
+// Guest registers are cached in r8d-r11d within a block. The dirty ones
+// are written back before an execution helper is called and at the exits
+// of the block. A helper may write any guest register, so the cache is
+// dropped after it. These host registers are caller-saved, since their
+// values are never needed after a call.
+#define NR_HOST_REG 4
+#define HOST_REG(k) (8 + (k))
+
+typedef struct {
+  int gpr[NR_HOST_REG]; // -1 if the host register is free
+  bool dirty[NR_HOST_REG];
+} RegCache;
+
+static RegCache cache;
+static int victim = 0;
+// host registers holding the operands of the current instruction
+static uint32_t pinned = 0;
+
+// mov r8d+k, [rbp + gpr]
+static void emit_reg_load(int k, int r) { emit8(0x44); emit8(0x8b); emit8(0x85 | (k << 3)); emit32(GPR(r)); }
+// mov [rbp + gpr], r8d+k
+static void emit_reg_store(int k, int r) { emit8(0x44); emit8(0x89); emit8(0x85 | (k << 3)); emit32(GPR(r)); }
+
+static void reg_drop() {
+  for (int k = 0; k < NR_HOST_REG; k ++) cache.gpr[k] = -1;
+}
+
+// write back the dirty registers, which are still cached
+static void reg_flush() {
+  for (int k = 0; k < NR_HOST_REG; k ++) {
+    if (cache.gpr[k] >= 0 && cache.dirty[k]) {
+      emit_reg_store(k, cache.gpr[k]);
+      cache.dirty[k] = false;
+    }
+  }
+}
+
+// reload all cached registers after a helper updates the guest registers
+static void reg_reload() {
+  for (int k = 0; k < NR_HOST_REG; k ++) {
+    if (cache.gpr[k] >= 0) emit_reg_load(k, cache.gpr[k]);
+  }
+}
+
+// Return the host register of guest register `r`, allocating a
+// free or unpinned one if `r` is not cached.
+static int reg_alloc(int r, bool *cached) {
+  for (int k = 0; k < NR_HOST_REG; k ++) {
+    if (cache.gpr[k] == r) { *cached = true; return k; }
+  }
+  *cached = false;
+  int k;
+  for (k = 0; k < NR_HOST_REG && cache.gpr[k] >= 0; k ++);
+  if (k == NR_HOST_REG) {
+    do { k = victim; victim = (victim + 1) % NR_HOST_REG; } while (pinned & (1u << k));
+    if (cache.dirty[k]) emit_reg_store(k, cache.gpr[k]);
+  }
+  cache.gpr[k] = r;
+  cache.dirty[k] = false;
+  return k;
+}
+
+// Return the host register holding the value of guest register `r`,
+// which is not $zero, and keep it until the end of the instruction.
+static int reg_use(int r) {
+  bool cached;
+  int k = reg_alloc(r, &cached);
+  if (!cached) emit_reg_load(k, r);
+  pinned |= 1u << k;
+  return k;
+}
+
+// Return the host register which receives the result for guest register `r`.
+static int reg_def(int r) {
+  bool cached;
+  int k = reg_alloc(r, &cached);
+  cache.dirty[k] = true;
+  return k;
+}
+
+// mov eax, src
+static void load_eax(int r) {
+  if (r == 0) { emit8(0x31); emit8(0xc0); return; } // xor eax, eax
+  int k = reg_use(r);
+  emit8(0x44); emit8(0x89); emit8(0xc0 | (k << 3)); // mov eax, r8d+k
+}
+// mov edx, src
+static void load_edx(int r) {
+  if (r == 0) { emit8(0x31); emit8(0xd2); return; } // xor edx, edx
+  int k = reg_use(r);
+  emit8(0x44); emit8(0x89); emit8(0xc2 | (k << 3)); // mov edx, r8d+k
+}
+// mov dst, eax
+static void store_eax(int r) {
+  if (r == 0) return;
+  int k = reg_def(r);
+  emit8(0x41); emit8(0x89); emit8(0xc0 | k); // mov r8d+k, eax
+}
+// mov dst, imm
+static void store_reg_imm(int r, uint32_t imm) {
+  if (r == 0) return;
+  int k = reg_def(r);
+  emit8(0x41); emit8(0xb8 + k); emit32(imm); // mov r8d+k, imm
+}
+// mov dword [rbp + off], imm
+static void store_imm(uint32_t off, uint32_t imm) { emit8(0xc7); emit8(0x85); emit32(off); emit32(imm); }
+// mov rax/rdi, imm64
+static void mov_rax(const void *x) { emit8(0x48); emit8(0xb8); emit64((uintptr_t)x); }
+static void mov_rdi(const void *x) { emit8(0x48); emit8(0xbf); emit64((uintptr_t)x); }
+// mov eax, imm
+static void mov_eax(uint32_t imm) { emit8(0xb8); emit32(imm); }
+
+static void emit_epilogue() {
+  emit8(0x41); emit8(0x5f); // pop r15
+  emit8(0x5d);              // pop rbp
+  emit8(0x5b);              // pop rbx
+  emit8(0xc3);              // ret
+}
+
+// the cache at the jumps to the slow path of the current instruction
+static RegCache slow_cache;
+
+// eax = src1 + imm - CONFIG_MBASE, and jump to the slow path
+// if the address is out of pmem
+static uint8_t* emit_pmem_addr(Decode *s, int len) {
+  load_eax(s->isa.rs1);
+  slow_cache = cache;
+  emit8(0x05); emit32(s->isa.imm - CONFIG_MBASE); // add eax, imm
+  emit8(0x3d); emit32(CONFIG_MSIZE - len + 1);    // cmp eax, imm
+  return emit_jcc(JAE);
+}
+
+// Translate `s` into native code, and return the number of jumps to
+// the slow path recorded in `slow`, or -1 if the instruction is not supported.
+static int emit_native(Decode *s, uint8_t **slow) {
+  uint32_t i = s->isa.inst;
+  switch (BITS(i, 6, 0)) {
+    case 0x17: // auipc
+      store_reg_imm(s->isa.rd, s->pc + s->isa.imm);
+      return 0;
+    case 0x03:
+      if (BITS(i, 14, 12) == 4) { // lbu
+        slow[0] = emit_pmem_addr(s, 1);
+        emit8(0x41); emit8(0x0f); emit8(0xb6); emit8(0x04); emit8(0x07); // movzx eax, byte [r15 + rax]
+        store_eax(s->isa.rd);
+        return 1;
+      }
+      break;
+    case 0x23:
+      if (BITS(i, 14, 12) == 0) { // sb
+        // rs2 is loaded before the jumps to the slow path, so that the
+        // cache is not changed on the fast path after them
+        load_edx(s->isa.rs2);
+        slow[0] = emit_pmem_addr(s, 1);
+        // stores to pages with translated code take the slow path,
+        // which flushes the translated blocks if necessary
+        emit8(0x89); emit8(0xc1);                           // mov ecx, eax
+        emit8(0xc1); emit8(0xe9); emit8(PAGE_SHIFT);        // shr ecx, PAGE_SHIFT
+        emit8(0x80); emit8(0x3c); emit8(0x0b); emit8(0x00); // cmp byte [rbx + rcx], 0
+        slow[1] = emit_jcc(JNE);
+        emit8(0x41); emit8(0x88); emit8(0x14); emit8(0x07); // mov [r15 + rax], dl
+#ifdef CONFIG_PMEM_DIRTY
+        // both maps are indexed by the page number, and the distance
+        // between them is checked in isa_jit_compile()
+        emit8(0xc6); emit8(0x84); emit8(0x0b);              // mov byte [rbx + rcx + dirty - code_page], 1
+        emit32(pmem_dirty_map() - block_cache_code_page()); emit8(0x01);
+#endif
+        return 2;
+      }
+      break;
+  }
+  return -1;
+}
+
+// Call the execution helper of the `idx`-th instruction, and leave
+// the block if the control flow is changed, the translated blocks are
+// flushed, or the reference design is requested to skip it.
+static void emit_helper(Block *b, int idx) {
+  Decode *s = &b->inst[idx];
+  uint8_t *exit[3];
+  int nr_exit = 0;
+
+  mov_rdi(s);
+  mov_rax(s->EHelper);
+  emit8(0xff); emit8(0xd0); // call rax
+
+  mov_rax(&s->dnpc);
+  emit8(0x8b); emit8(0x00); // mov eax, [rax]
+  emit8(0x3d); emit32(s->snpc); // cmp eax, snpc
+  exit[nr_exit ++] = emit_jcc(JNE);
+
+  mov_rax(&g_block_gen);
+  emit8(0x81); emit8(0x38); emit32(b->gen); // cmp dword [rax], gen
+  exit[nr_exit ++] = emit_jcc(JNE);
+
+#ifdef CONFIG_DIFFTEST
+  mov_rax(difftest_skip_pending);
+  emit8(0xff); emit8(0xd0); // call rax
+  emit8(0x84); emit8(0xc0); // test al, al
+  exit[nr_exit ++] = emit_jcc(JNE);
+#endif
+
+  uint8_t *next = emit_jmp();
+  for (int k = 0; k < nr_exit; k ++) patch(exit[k]);
+  mov_rax(&s->dnpc);
+  emit8(0x8b); emit8(0x00); // mov eax, [rax]
+  emit8(0x89); emit8(0x85); emit32(PC); // mov [rbp + pc], eax
+  mov_eax(idx + 1);
+  emit_epilogue();
+  patch(next);
+}
+
+// Compile block `b` into `code`, and return the end of the generated code.
+// The generated function executes the whole block and returns the number
+// of executed instructions, with cpu.pc updated. If no instruction in the
+// block has a native translation, the generated code is not faster than
+// the interpreter, so it is dropped and `code` is returned.
+uint8_t* isa_jit_compile(Block *b, uint8_t *code, uint8_t *code_end) {
+#ifdef CONFIG_PMEM_DIRTY
+  intptr_t dist = pmem_dirty_map() - block_cache_code_page();
+  assert(dist == (int32_t)dist);
+#endif
+  p = code;
+  emit8(0x53);              // push rbx
+  emit8(0x55);              // push rbp
+  emit8(0x41); emit8(0x57); // push r15
+  emit8(0x48); emit8(0xbd); emit64((uintptr_t)&cpu);                       // mov rbp, &cpu
+  emit8(0x49); emit8(0xbf); emit64((uintptr_t)guest_to_host(CONFIG_MBASE)); // mov r15, pmem
+  emit8(0x48); emit8(0xbb); emit64((uintptr_t)block_cache_code_page());    // mov rbx, code_page
+
+  reg_drop();
+  int nr_native = 0;
+  for (int i = 0; i < b->nr_inst; i ++) {
+    uint8_t *slow[2];
+    pinned = 0;
+    int nr_slow = emit_native(&b->inst[i], slow);
+    if (nr_slow >= 0) nr_native ++;
+    if (nr_slow == 0) continue;
+    if (nr_slow > 0) {
+      // The slow path starts with the cache at the jumps, and joins the
+      // fast path with the cache after the instruction.
+      uint8_t *next = emit_jmp();
+      for (int k = 0; k < nr_slow; k ++) patch(slow[k]);
+      RegCache fast = cache;
+      cache = slow_cache;
+      reg_flush();
+      emit_helper(b, i);
+      cache = fast;
+      reg_reload();
+      patch(next);
+    } else {
+      reg_flush();
+      emit_helper(b, i);
+      reg_drop();
+    }
+    Assert(p <= code_end, "code cache overflow");
+  }
+
+  reg_flush();
+  store_imm(PC, b->inst[b->nr_inst - 1].snpc);
+  mov_eax(b->nr_inst);
+  emit_epilogue();
+  Assert(p <= code_end, "code cache overflow");
+  return (nr_native > 0 ? p : code);
+}
@@ -17,6 +17,8 @@
 #include <memory/vaddr.h>
 #include <memory/paddr.h>
 
+// Translations are cached by the TLB in vaddr.c, so tlb_flush() should
+// be called when satp is written and when sfence.vma is executed.
 paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type) {
   return MEM_RET_FAIL;
 }
@@ -0,0 +1,90 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <memory/host.h>
+#include <sys/mman.h>
+
+#ifndef CONFIG_HUGEPAGE_NONE
+// Return the mode of transparent huge pages of the host,
+// which is "always", "madvise" or "never".
+static const char* thp_mode() {
+  static char mode[16] = "unknown";
+  FILE *fp = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+  if (fp == NULL) return mode;
+  char buf[64];
+  if (fgets(buf, sizeof(buf), fp) != NULL) {
+    char *l = strchr(buf, '['), *r = strchr(buf, ']');
+    if (l != NULL && r != NULL && r - l - 1 < sizeof(mode)) {
+      *r = '\0';
+      strcpy(mode, l + 1);
+    }
+  }
+  fclose(fp);
+  return mode;
+}
+#endif
+
+#ifdef CONFIG_HUGEPAGE_HUGETLB
+#define MAX_HUGETLB_MAP 8
+static struct { const uint8_t *start, *end; } hugetlb_map[MAX_HUGETLB_MAP];
+static int nr_hugetlb_map = 0;
+#endif
+
+bool host_is_hugetlb(const void *p) {
+#ifdef CONFIG_HUGEPAGE_HUGETLB
+  for (int i = 0; i < nr_hugetlb_map; i ++) {
+    if ((const uint8_t *)p >= hugetlb_map[i].start && (const uint8_t *)p < hugetlb_map[i].end) return true;
+  }
+#endif
+  return false;
+}
+
+uint8_t* host_map(const char *name, size_t size, bool accessible) {
+  int prot = (accessible ? PROT_READ | PROT_WRITE : PROT_NONE);
+  size = ROUNDUP(size, host_map_unit());
+  uint8_t *p;
+
+#ifdef CONFIG_HUGEPAGE_HUGETLB
+  // huge pages are reserved here, so that the mapping fails
+  // instead of getting SIGBUS when they are not enough
+  p = mmap(NULL, size, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (p != MAP_FAILED) {
+    Log("%s: %zu huge pages from hugetlbfs", name, size / HUGE_PAGE_SIZE);
+    Assert(nr_hugetlb_map < MAX_HUGETLB_MAP, "too many mappings of hugetlbfs");
+    hugetlb_map[nr_hugetlb_map].start = p;
+    hugetlb_map[nr_hugetlb_map ++].end = p + size;
+    return p;
+  }
+  Log("%s: not enough huge pages from hugetlbfs", name);
+#endif
+
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+#ifdef CONFIG_HUGEPAGE_NONE
+  p = mmap(NULL, size, prot, flags, -1, 0);
+  Assert(p != MAP_FAILED, "failed to map %s", name);
+#else
+  // map one more huge page to align the start
+  uint8_t *raw = mmap(NULL, size + HUGE_PAGE_SIZE, prot, flags, -1, 0);
+  Assert(raw != MAP_FAILED, "failed to map %s", name);
+  p = (uint8_t *)ROUNDUP(raw, HUGE_PAGE_SIZE);
+  if (p != raw) munmap(raw, p - raw);
+  munmap(p + size, raw + HUGE_PAGE_SIZE - p);
+
+  const char *mode = thp_mode();
+  bool ok = (madvise(p, size, MADV_HUGEPAGE) == 0 && strcmp(mode, "never") != 0);
+  Log("%s: transparent huge pages %s (host mode: %s)", name, ok ? "enabled" : "unavailable", mode);
+#endif
+  return p;
+}
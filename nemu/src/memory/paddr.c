@@ -15,10 +15,12 @@
 
 #include <memory/host.h>
 #include <memory/paddr.h>
-#include <device/mmio.h>
+#include <memory/vaddr.h>
+#include <memory/pma.h>
+#include <cpu/decode.h>
 #include <isa.h>
 
-#if   defined(CONFIG_PMEM_MALLOC)
+#if   defined(CONFIG_PMEM_MALLOC) || defined(CONFIG_PMEM_MMAP)
 static uint8_t *pmem = NULL;
 #else // CONFIG_PMEM_GARRAY
 static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
@@ -27,38 +29,285 @@ static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
 uint8_t* guest_to_host(paddr_t paddr) { return pmem + paddr - CONFIG_MBASE; }
 paddr_t host_to_guest(uint8_t *haddr) { return haddr - pmem + CONFIG_MBASE; }
 
-static word_t pmem_read(paddr_t addr, int len) {
+#ifdef CONFIG_PMEM_DIRTY
+// Pages of pmem which may have been written since they are cleared. A
+// page is marked when it is written by paddr_write(), or once the TLB
+// allows direct stores to it, so that the fast path of stores is not
+// slowed down. Clearing pages flushes the TLB for the same reason.
+static uint8_t dirty_page[CONFIG_MSIZE >> PAGE_SHIFT] = {};
+#define DIRTY_IDX(addr) (((addr) - CONFIG_MBASE) >> PAGE_SHIFT)
+
+void pmem_set_dirty(paddr_t addr) { dirty_page[DIRTY_IDX(addr)] = 1; }
+uint8_t* pmem_dirty_map() { return dirty_page; }
+
+bool pmem_is_dirty(paddr_t addr, size_t len) {
+  for (size_t i = DIRTY_IDX(addr); i <= DIRTY_IDX(addr + len - 1); i ++) {
+    if (dirty_page[i]) return true;
+  }
+  return false;
+}
+
+void pmem_clear_dirty(paddr_t addr, size_t len) {
+  memset(&dirty_page[DIRTY_IDX(addr)], 0, DIRTY_IDX(addr + len - 1) - DIRTY_IDX(addr) + 1);
+  tlb_flush();
+}
+
+// Call `f` with every maximal range of dirty pages.
+void pmem_foreach_dirty(void (*f)(paddr_t addr, size_t len, void *arg), void *arg) {
+  const size_t nr_page = ARRLEN(dirty_page);
+  size_t i = 0;
+  while (i < nr_page) {
+    // skip clean pages a word at a time
+    uint64_t w;
+    if (i % 8 == 0 && i + 8 <= nr_page && (memcpy(&w, &dirty_page[i], 8), w == 0)) { i += 8; continue; }
+    if (!dirty_page[i]) { i ++; continue; }
+    size_t j = i;
+    while (j < nr_page && dirty_page[j]) j ++;
+    f(CONFIG_MBASE + i * PAGE_SIZE, (j - i) * PAGE_SIZE, arg);
+    i = j;
+  }
+}
+#endif
+
+static inline word_t pmem_read(paddr_t addr, int len) {
   word_t ret = host_read(guest_to_host(addr), len);
   return ret;
 }
 
-static void pmem_write(paddr_t addr, int len, word_t data) {
+static inline void pmem_write(paddr_t addr, int len, word_t data) {
   host_write(guest_to_host(addr), len, data);
+  IFDEF(CONFIG_PMEM_DIRTY, dirty_page[DIRTY_IDX(addr)] = dirty_page[DIRTY_IDX(addr + len - 1)] = 1);
+  decode_cache_invalidate(addr, len);
+  block_cache_invalidate(addr, len);
+}
+
+static PMARegion *pmem_region = NULL;
+
+// pages of RAM with cached instructions, which should only be written
+// by paddr_write(); a page stays protected after the caches of
+// translated code are flushed
+void paddr_protect(paddr_t addr) {
+  PMARegion *r = (in_pmem(addr) ? pmem_region : pma_find(addr));
+  if (r->protected_page == NULL) return;
+  uint8_t *p = &r->protected_page[(addr >> PAGE_SHIFT) - (r->low >> PAGE_SHIFT)];
+  if (*p) return;
+  *p = 1;
+  // the TLB may allow direct stores to this page
+  tlb_flush();
+}
+
+bool paddr_is_protected(paddr_t addr) {
+  PMARegion *r = (in_pmem(addr) ? pmem_region : pma_find(addr));
+  return r->protected_page != NULL &&
+    r->protected_page[(addr >> PAGE_SHIFT) - (r->low >> PAGE_SHIFT)];
+}
+
+#ifdef CONFIG_PMEM_MMAP
+#include <sys/mman.h>
+#include <signal.h>
+
+#ifdef CONFIG_MEM_RANDOM
+// Pages of pmem, and of the RAM banks of the board, are inaccessible
+// until they are touched for the first time. The fault is caught by the
+// handler of SIGSEGV, which makes the page accessible and fills it with
+// the random value. A whole huge page is filled at once, so that it is
+// not split by mprotect().
+static uint8_t mem_random_val = 0;
+static struct sigaction old_segv_action;
+
+typedef struct {
+  uint8_t *start, *end;
+} LazyMap;
+
+static LazyMap *lazy_map = NULL;
+static int nr_lazy_map = 0;
+
+static void lazy_map_add(uint8_t *start, size_t size) {
+  lazy_map = realloc(lazy_map, sizeof(LazyMap) * (nr_lazy_map + 1));
+  assert(lazy_map);
+  lazy_map[nr_lazy_map ++] = (LazyMap){ .start = start, .end = start + size };
+}
+
+static bool pmem_fill(uint8_t *start, size_t len) {
+  if (mprotect(start, len, PROT_READ | PROT_WRITE) != 0) return false;
+  memset(start, mem_random_val, len);
+  return true;
+}
+
+static void pmem_fault_handler(int sig, siginfo_t *info, void *ucontext) {
+  uint8_t *addr = info->si_addr;
+  for (int i = 0; i < nr_lazy_map; i ++) {
+    if (addr >= lazy_map[i].start && addr < lazy_map[i].end) {
+      size_t unit = host_map_unit();
+      if (pmem_fill((uint8_t *)ROUNDDOWN(addr, unit), unit)) return;
+      break;
+    }
+  }
+  // not a fault of pmem, then the instruction faults again
+  // and the previous action is taken
+  sigaction(SIGSEGV, &old_segv_action, NULL);
+}
+#endif
+
+static void init_pmem_mmap() {
+  pmem = host_map("pmem", CONFIG_MSIZE, MUXDEF(CONFIG_MEM_RANDOM, false, true));
+#ifdef CONFIG_MEM_RANDOM
+  lazy_map_add(pmem, CONFIG_MSIZE);
+  mem_random_val = rand();
+  struct sigaction act = { .sa_sigaction = pmem_fault_handler, .sa_flags = SA_SIGINFO };
+  sigemptyset(&act.sa_mask);
+  int ret = sigaction(SIGSEGV, &act, &old_segv_action);
+  assert(ret == 0);
+#endif
+}
+
+#endif
+
+// Allocate the memory of a bank of RAM or ROM outside pmem. RAM is
+// initialized in the same way as pmem, lazily if possible, and ROM is
+// filled with zero.
+uint8_t* paddr_new_bank(const char *name, size_t size, bool is_ram) {
+#ifdef CONFIG_PMEM_MMAP
+  bool lazy = is_ram && MUXDEF(CONFIG_MEM_RANDOM, true, false);
+  uint8_t *p = host_map(name, size, !lazy);
+  IFDEF(CONFIG_MEM_RANDOM, if (lazy) lazy_map_add(p, ROUNDUP(size, host_map_unit())));
+#else
+  uint8_t *p = malloc(size);
+  assert(p);
+  memset(p, (is_ram ? MUXDEF(CONFIG_MEM_RANDOM, rand(), 0) : 0), size);
+#endif
+  return p;
+}
+
+// Touch the pages of [p, p + len) before they are written by the
+// kernel, e.g. read(), which does not trigger the lazy initialization.
+void host_prefault(uint8_t *p, size_t len) {
+#if defined(CONFIG_PMEM_MMAP) && defined(CONFIG_MEM_RANDOM)
+  for (size_t i = 0; i < len; i += PAGE_SIZE) {
+    (void)*(volatile uint8_t *)(p + i);
+  }
+  if (len > 0) (void)*(volatile uint8_t *)(p + len - 1);
+#endif
+}
+
+void pmem_prefault(paddr_t addr, size_t len) {
+  host_prefault(guest_to_host(addr), len);
 }
 
-static void out_of_bound(paddr_t addr) {
-  panic("address = " FMT_PADDR " is out of bound of pmem [" FMT_PADDR ", " FMT_PADDR "] at pc = " FMT_WORD,
-      addr, PMEM_LEFT, PMEM_RIGHT, cpu.pc);
+#ifndef CONFIG_TARGET_AM
+#include <unistd.h>
+
+static void check_range(paddr_t addr, size_t size) {
+  Assert(in_pmem(addr) && size <= PMEM_RIGHT - addr + 1, "[" FMT_PADDR ", " FMT_PADDR
+      "] is out of bound of pmem", addr, (paddr_t)(addr + size - 1));
+}
+
+static void pmem_pread(paddr_t addr, int fd, uint64_t offset, size_t size) {
+  pmem_prefault(addr, size);
+  uint8_t *buf = guest_to_host(addr);
+  while (size > 0) {
+    ssize_t ret = pread(fd, buf, size, offset);
+    Assert(ret > 0, "failed to read the image");
+    buf += ret; offset += ret; size -= ret;
+  }
+}
+
+#ifdef CONFIG_PMEM_MMAP
+// Replace the whole pages in [addr, addr + len) with a new mapping. The
+// units at both ends are filled before, since they may be partly replaced.
+static void pmem_remap(paddr_t addr, size_t len, int fd, uint64_t offset) {
+  pmem_prefault(addr, 1);
+  pmem_prefault(addr + len - 1, 1);
+  uint8_t *start = guest_to_host(addr);
+  int flags = MAP_PRIVATE | MAP_FIXED | (fd == -1 ? MAP_ANONYMOUS | MAP_NORESERVE : 0);
+  void *p = mmap(start, len, PROT_READ | PROT_WRITE, flags, fd, offset);
+  Assert(p == start, "failed to map [" FMT_PADDR ", " FMT_PADDR "] of pmem",
+      addr, (paddr_t)(addr + len - 1));
+  IFNDEF(CONFIG_HUGEPAGE_NONE, madvise(start, len, MADV_HUGEPAGE));
 }
+#endif
+
+// Load `size` bytes at `offset` of file `fd` to pmem at `addr`. With
+// IMG_MMAP, the whole pages are mapped as private copy-on-write pages,
+// which are read when they are touched, and the pages shared with other
+// data are read. Pages of hugetlbfs can not be split, so the file is
+// always read into them.
+void pmem_load_file(paddr_t addr, int fd, uint64_t offset, size_t size) {
+  if (size == 0) return;
+  check_range(addr, size);
+#ifdef CONFIG_IMG_MMAP
+  paddr_t l = ROUNDUP(addr, PAGE_SIZE), r = ROUNDDOWN(addr + size, PAGE_SIZE);
+  if (((addr - offset) & PAGE_MASK) == 0 && l < r && !host_is_hugetlb(pmem)) {
+    pmem_remap(l, r - l, fd, offset + (l - addr));
+    pmem_pread(addr, fd, offset, l - addr);
+    pmem_pread(r, fd, offset + (r - addr), addr + size - r);
+    return;
+  }
+#endif
+  pmem_pread(addr, fd, offset, size);
+}
+
+// Fill [addr, addr + size) with zero. The whole pages are replaced
+// by fresh anonymous pages, which are allocated when they are touched,
+// unless pmem is backed by hugetlbfs.
+void pmem_zero(paddr_t addr, size_t size) {
+  if (size == 0) return;
+  check_range(addr, size);
+#ifdef CONFIG_PMEM_MMAP
+  paddr_t l = ROUNDUP(addr, PAGE_SIZE), r = ROUNDDOWN(addr + size, PAGE_SIZE);
+  if (l < r && !host_is_hugetlb(pmem)) {
+    pmem_remap(l, r - l, -1, 0);
+    memset(guest_to_host(addr), 0, l - addr);
+    memset(guest_to_host(r), 0, addr + size - r);
+    return;
+  }
+#endif
+  memset(guest_to_host(addr), 0, size);
+}
+#endif
 
 void init_mem() {
 #if   defined(CONFIG_PMEM_MALLOC)
   pmem = malloc(CONFIG_MSIZE);
   assert(pmem);
+#elif defined(CONFIG_PMEM_MMAP)
+  init_pmem_mmap();
 #endif
+#ifndef CONFIG_PMEM_MMAP
   IFDEF(CONFIG_MEM_RANDOM, memset(pmem, rand(), CONFIG_MSIZE));
+#endif
+  // the initial content is regarded as written
+  IFDEF(CONFIG_PMEM_DIRTY, memset(dirty_page, 1, sizeof(dirty_page)));
+  pmem_region = pma_add("pmem", PMA_RAM, CONFIG_MBASE, CONFIG_MSIZE, pmem);
+  tlb_flush();
   Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
 }
 
-word_t paddr_read(paddr_t addr, int len) {
+static inline word_t paddr_read_n(paddr_t addr, int len) {
   if (likely(in_pmem(addr))) return pmem_read(addr, len);
-  IFDEF(CONFIG_DEVICE, return mmio_read(addr, len));
-  out_of_bound(addr);
-  return 0;
+  return pma_read(addr, len);
 }
 
-void paddr_write(paddr_t addr, int len, word_t data) {
+static inline void paddr_write_n(paddr_t addr, int len, word_t data) {
   if (likely(in_pmem(addr))) { pmem_write(addr, len, data); return; }
-  IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
-  out_of_bound(addr);
+  pma_write(addr, len, data);
 }
+
+word_t paddr_read(paddr_t addr, int len) {
+  return paddr_read_n(addr, len);
+}
+
+void paddr_write(paddr_t addr, int len, word_t data) {
+  paddr_write_n(addr, len, data);
+}
+
+// the width is a constant in the specialized versions, so that
+// host_read() and host_write() do not branch on it
+#define def_paddr_access(bits) \
+  word_t concat(paddr_read, bits)(paddr_t addr) { \
+    return paddr_read_n(addr, bits / 8); \
+  } \
+  void concat(paddr_write, bits)(paddr_t addr, word_t data) { \
+    paddr_write_n(addr, bits / 8, data); \
+  }
+MAP(MEM_WIDTHS, def_paddr_access)
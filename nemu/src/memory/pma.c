@@ -0,0 +1,316 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <memory/host.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <memory/pma.h>
+#include <device/mmio.h>
+#include <cpu/decode.h>
+
+static const char *type_name[] = {
+  [PMA_NONE] = "none", [PMA_RAM] = "ram", [PMA_ROM] = "rom", [PMA_MMIO] = "mmio",
+};
+
+// sorted by address, and grown when it is full
+static PMARegion **regions = NULL;
+static int nr_region = 0, max_region = 0;
+
+static PMARegion unmapped = { .name = "unmapped", .type = PMA_NONE };
+
+// The regions are also looked up by pages with a two-level table, in the
+// same way as the IOTable of the devices, so that finding the region of
+// an access does not depend on the number of regions. A page covered by
+// a single region points to it directly, while a page shared by several
+// regions, or partially covered, has a table with the region of every
+// byte. Addresses beyond 4 GiB are only found in the sorted array.
+#define PMA_DIR_SHIFT 22
+#define PMA_NR_DIR (1 << (32 - PMA_DIR_SHIFT))
+#define PMA_NR_DIR_PAGE (1 << (PMA_DIR_SHIFT - PAGE_SHIFT))
+
+typedef struct {
+  PMARegion *region;
+  PMARegion **sub;
+} PMAPage;
+
+static PMAPage *pma_dir[PMA_NR_DIR] = {};
+
+static PMAPage* pma_page(paddr_t addr) {
+  PMAPage **dir = &pma_dir[(uint32_t)addr >> PMA_DIR_SHIFT];
+  if (*dir == NULL) {
+    *dir = calloc(PMA_NR_DIR_PAGE, sizeof(PMAPage));
+    assert(*dir);
+  }
+  return &(*dir)[(addr >> PAGE_SHIFT) & (PMA_NR_DIR_PAGE - 1)];
+}
+
+// the region does not overlap with others, which is checked by pma_add()
+static void pma_index(PMARegion *r) {
+  if (MUXDEF(PMEM64, r->low >> 32, 0)) return;
+  paddr_t right = MUXDEF(PMEM64, (r->high >> 32 ? 0xffffffffu : r->high), r->high);
+  for (paddr_t page = r->low & ~PAGE_MASK; ; page += PAGE_SIZE) {
+    PMAPage *p = pma_page(page);
+    paddr_t l = (page > r->low ? page : r->low);
+    paddr_t h = (page + PAGE_MASK < right ? page + PAGE_MASK : right);
+    if (l == page && h == page + PAGE_MASK && p->sub == NULL) p->region = r;
+    else {
+      if (p->sub == NULL) {
+        p->sub = calloc(PAGE_SIZE, sizeof(PMARegion *));
+        assert(p->sub);
+      }
+      for (uint32_t i = l & PAGE_MASK; i <= (h & PAGE_MASK); i ++) p->sub[i] = r;
+    }
+    if (h == right) break;
+  }
+}
+
+#ifdef PMEM64
+static PMARegion* pma_search(paddr_t addr) {
+  int l = 0, h = nr_region - 1;
+  while (l <= h) {
+    int m = (l + h) / 2;
+    PMARegion *r = regions[m];
+    if (addr < r->low) h = m - 1;
+    else if (addr > r->high) l = m + 1;
+    else return r;
+  }
+  return &unmapped;
+}
+#endif
+
+static word_t mem_read(PMARegion *r, paddr_t addr, int len) {
+  return host_read(r->host + (addr - r->low), len);
+}
+
+static inline uint8_t* protected_flag(PMARegion *r, paddr_t addr) {
+  return &r->protected_page[(addr >> PAGE_SHIFT) - (r->low >> PAGE_SHIFT)];
+}
+
+static void mem_write(PMARegion *r, paddr_t addr, int len, word_t data) {
+  host_write(r->host + (addr - r->low), len, data);
+  // the caches of translated code only track the instructions in pmem,
+  // so they are flushed when the code in other regions is modified
+  if (*protected_flag(r, addr) || *protected_flag(r, addr + len - 1)) {
+    decode_cache_flush();
+    block_cache_flush();
+  }
+}
+
+#ifdef CONFIG_DEVICE
+static word_t dev_read(PMARegion *r, paddr_t addr, int len) {
+  return mmio_read(addr, len);
+}
+
+static void dev_write(PMARegion *r, paddr_t addr, int len, word_t data) {
+  mmio_write(addr, len, data);
+}
+#endif
+
+static const struct {
+  int perm;
+  word_t (*read)(PMARegion *r, paddr_t addr, int len);
+  void (*write)(PMARegion *r, paddr_t addr, int len, word_t data);
+} attr[] = {
+  [PMA_NONE] = { 0, NULL, NULL },
+  [PMA_RAM]  = { PMA_R | PMA_W | PMA_X, mem_read, mem_write },
+  [PMA_ROM]  = { PMA_R | PMA_X, mem_read, NULL },
+  [PMA_MMIO] = { PMA_R | PMA_W, MUXDEF(CONFIG_DEVICE, dev_read, NULL), MUXDEF(CONFIG_DEVICE, dev_write, NULL) },
+};
+
+static void report_overlap(const char *name, int type, paddr_t low, paddr_t high, PMARegion *old) {
+  panic("%s region %s@[" FMT_PADDR ", " FMT_PADDR "] is overlapped with %s region %s@["
+      FMT_PADDR ", " FMT_PADDR "]", type_name[type], name, low, high,
+      type_name[old->type], old->name, old->low, old->high);
+}
+
+// Add the region [addr, addr + len) to the table. The memory of
+// RAM and ROM is `host`, and MMIO is handled by the devices.
+PMARegion* pma_add(const char *name, int type, paddr_t addr, paddr_t len, uint8_t *host) {
+  paddr_t low = addr, high = addr + len - 1;
+  assert(len > 0 && high >= low);
+  assert((type != PMA_RAM && type != PMA_ROM) || host != NULL);
+
+  int i = nr_region;
+  while (i > 0 && regions[i - 1]->low > low) i --;
+  if (i > 0 && regions[i - 1]->high >= low) report_overlap(name, type, low, high, regions[i - 1]);
+  if (i < nr_region && regions[i]->low <= high) report_overlap(name, type, low, high, regions[i]);
+
+  PMARegion *r = malloc(sizeof(PMARegion));
+  assert(r);
+  *r = (PMARegion){ .name = name, .low = low, .high = high, .type = type,
+    .perm = attr[type].perm, .host = host, .read = attr[type].read, .write = attr[type].write };
+  if (type == PMA_RAM) {
+    r->protected_page = calloc((high >> PAGE_SHIFT) - (low >> PAGE_SHIFT) + 1, 1);
+    assert(r->protected_page);
+  }
+
+  if (nr_region == max_region) {
+    max_region = (max_region == 0 ? 16 : max_region * 2);
+    regions = realloc(regions, sizeof(regions[0]) * max_region);
+    assert(regions);
+  }
+  memmove(&regions[i + 1], &regions[i], (nr_region - i) * sizeof(regions[0]));
+  regions[i] = r;
+  nr_region ++;
+  pma_index(r);
+  return r;
+}
+
+PMARegion* pma_find(paddr_t addr) {
+#ifdef PMEM64
+  if (addr >> 32) return pma_search(addr);
+#endif
+  PMAPage *dir = pma_dir[(uint32_t)addr >> PMA_DIR_SHIFT];
+  if (dir == NULL) return &unmapped;
+  PMAPage *p = &dir[(addr >> PAGE_SHIFT) & (PMA_NR_DIR_PAGE - 1)];
+  if (likely(p->region != NULL)) return p->region;
+  PMARegion *r = (p->sub == NULL ? NULL : p->sub[addr & PAGE_MASK]);
+  return (r == NULL ? &unmapped : r);
+}
+
+static void pma_fault(PMARegion *r, paddr_t addr, int perm) {
+  if (r == &unmapped) {
+    panic("address = " FMT_PADDR " is out of bound of pmem [" FMT_PADDR ", " FMT_PADDR "] at pc = " FMT_WORD,
+        addr, PMEM_LEFT, PMEM_RIGHT, cpu.pc);
+  }
+  panic("%s at address = " FMT_PADDR " is not allowed by %s region %s@[" FMT_PADDR ", " FMT_PADDR
+      "] at pc = " FMT_WORD, (perm == PMA_R ? "read" : perm == PMA_W ? "write" : "fetch"),
+      addr, type_name[r->type], r->name, r->low, r->high, cpu.pc);
+}
+
+word_t pma_read(paddr_t addr, int len) {
+  PMARegion *r = pma_find(addr);
+  if (unlikely(!(r->perm & PMA_R))) pma_fault(r, addr, PMA_R);
+  return r->read(r, addr, len);
+}
+
+void pma_write(paddr_t addr, int len, word_t data) {
+  PMARegion *r = pma_find(addr);
+  if (unlikely(!(r->perm & PMA_W))) pma_fault(r, addr, PMA_W);
+  r->write(r, addr, len, data);
+}
+
+// Check an access of `type` to `addr`, and return the host address of
+// the page of `addr` if it can be accessed like memory. Otherwise return
+// NULL, and the access goes through pma_read() and pma_write().
+uint8_t* pma_direct_page(paddr_t addr, int type) {
+  // the region may not cover the whole page
+  PMARegion *r = pma_find(addr);
+  paddr_t page = addr & ~PAGE_MASK;
+  int perm = (type == MEM_TYPE_IFETCH ? PMA_X : type == MEM_TYPE_READ ? PMA_R : PMA_W);
+  if (unlikely(!(r->perm & perm))) {
+    // MMIO is fetched through pma_read(), which reports other faults
+    if (type == MEM_TYPE_IFETCH && (r->perm & PMA_R)) return NULL;
+    pma_fault(r, addr, perm);
+  }
+  switch (r->type) {
+    case PMA_RAM: case PMA_ROM:
+      if (page < r->low || page + PAGE_MASK > r->high) return NULL;
+      return r->host + (page - r->low);
+    case PMA_MMIO:
+      return MUXDEF(CONFIG_DEVICE, mmio_direct_page(page, type == MEM_TYPE_WRITE), NULL);
+  }
+  return NULL;
+}
+
+#ifndef CONFIG_TARGET_AM
+#include <unistd.h>
+
+// Load `size` bytes at `offset` of file `fd` to [addr, addr + size), or
+// fill zero if `fd` is -1. The memory of RAM and ROM is written directly,
+// and other regions are written through their handlers, which report
+// the regions that can not be written.
+void pma_load_file(paddr_t addr, int fd, uint64_t offset, size_t size) {
+  while (size > 0) {
+    PMARegion *r = pma_find(addr);
+    size_t n = size;
+    if (r != &unmapped && r->high - addr < n - 1) n = r->high - addr + 1;
+    if (r->host != NULL) {
+      uint8_t *host = r->host + (addr - r->low);
+      if (fd == -1) memset(host, 0, n);
+      else {
+        host_prefault(host, n);
+        for (size_t done = 0; done < n; ) {
+          ssize_t ret = pread(fd, host + done, n - done, offset + done);
+          Assert(ret > 0, "failed to read the image");
+          done += ret;
+        }
+      }
+    } else {
+      uint8_t buf[4096] = {};
+      for (size_t done = 0; done < n; ) {
+        size_t len = (n - done < sizeof(buf) ? n - done : sizeof(buf));
+        if (fd != -1) {
+          ssize_t ret = pread(fd, buf, len, offset + done);
+          Assert(ret > 0, "failed to read the image");
+          len = ret;
+        }
+        for (size_t i = 0; i < len; i ++) pma_write(addr + done + i, 1, buf[i]);
+        done += len;
+      }
+    }
+    addr += n; offset += n; size -= n;
+  }
+}
+
+static void load_bank(uint8_t *host, paddr_t len, const char *file) {
+  FILE *fp = fopen(file, "rb");
+  Assert(fp, "Can not open '%s'", file);
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  Assert(size <= len, "'%s' is larger than the region", file);
+  fseek(fp, 0, SEEK_SET);
+  host_prefault(host, size);
+  int ret = fread(host, size, 1, fp);
+  assert(size == 0 || ret == 1);
+  fclose(fp);
+}
+
+// Add the regions in the board description `file`. Each line is
+//   TYPE NAME BASE SIZE [IMAGE]
+// where TYPE is ram, rom or none, and BASE and SIZE are in hex. The
+// region is initialized with IMAGE if it is given.
+void init_board(const char *file) {
+  if (file == NULL || file[0] == '\0') return;
+  FILE *fp = fopen(file, "r");
+  Assert(fp, "Can not open board description '%s'", file);
+  char line[512];
+  for (int lineno = 1; fgets(line, sizeof(line), fp) != NULL; lineno ++) {
+    char *p = line + strspn(line, " \t");
+    if (*p == '#' || *p == '\n' || *p == '\0') continue;
+    char type[16], name[64], image[256] = "";
+    uint64_t base, size;
+    int n = sscanf(p, "%15s %63s %" SCNx64 " %" SCNx64 " %255s", type, name, &base, &size, image);
+    Assert(n >= 4, "%s:%d: expect 'TYPE NAME BASE SIZE [IMAGE]'", file, lineno);
+
+    int t = (strcmp(type, "ram") == 0 ? PMA_RAM : strcmp(type, "rom") == 0 ? PMA_ROM :
+        strcmp(type, "none") == 0 ? PMA_NONE : -1);
+    Assert(t != -1, "%s:%d: unknown type '%s'", file, lineno, type);
+    Assert(t != PMA_NONE || image[0] == '\0', "%s:%d: unmapped region with an image", file, lineno);
+
+    const char *s = strdup(name);
+    uint8_t *host = NULL;
+    if (t != PMA_NONE) {
+      host = paddr_new_bank(s, size, t == PMA_RAM);
+      if (image[0] != '\0') load_bank(host, size, image);
+    }
+    pma_add(s, t, base, size, host);
+    Log("board: %s region %s@[" FMT_PADDR ", " FMT_PADDR "]%s%s", type, s,
+        (paddr_t)base, (paddr_t)(base + size - 1), (image[0] ? " from " : ""), image);
+  }
+  fclose(fp);
+}
+#endif
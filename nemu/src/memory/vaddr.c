@@ -14,8 +14,151 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <memory/pma.h>
+
+#ifdef CONFIG_SOFT_TLB
+#define NR_TLB CONFIG_SOFT_TLB_SIZE
+// fold the high bits into the index, so that pages of different regions
+// with the same low bits, like the code in pmem and the frame buffer,
+// do not evict each other
+#define TLB_IDX(addr) ((((addr) >> PAGE_SHIFT) ^ ((addr) >> 22)) & (NR_TLB - 1))
+
+static_assert((NR_TLB & (NR_TLB - 1)) == 0, "TLB size should be a power of 2");
+
+// A tag is the base of the virtual page, which is valid for one type
+// of access. TLB_SLOW is set if the page is translated, but the access
+// should go through paddr_read() or paddr_write(). Since tags are page
+// aligned, TLB_INVALID never matches.
+#define TLB_SLOW    ((vaddr_t)1)
+#define TLB_INVALID ((vaddr_t)-1)
+
+typedef struct {
+  vaddr_t tag[3];     // indexed by MEM_TYPE_*
+  vaddr_t vpage;
+  paddr_t ppage;
+  uintptr_t addend;   // host address = vaddr + addend
+} TLBEntry;
+
+static TLBEntry tlb[NR_TLB];
+
+void tlb_flush() {
+  for (int i = 0; i < NR_TLB; i ++) {
+    tlb[i].tag[MEM_TYPE_IFETCH] = tlb[i].tag[MEM_TYPE_READ] = tlb[i].tag[MEM_TYPE_WRITE] = TLB_INVALID;
+  }
+}
+
+static inline bool in_page(vaddr_t addr, int len) {
+  return (addr & PAGE_MASK) + len <= PAGE_SIZE;
+}
+
+static void tlb_fill(vaddr_t addr, int len, int type) {
+  vaddr_t vpage = addr & ~PAGE_MASK;
+  paddr_t ppage = vpage;
+  switch (isa_mmu_check(addr, len, type)) {
+    case MMU_DIRECT: break;
+    case MMU_TRANSLATE: {
+      paddr_t ret = isa_mmu_translate(addr, len, type);
+      Assert((ret & PAGE_MASK) == MEM_RET_OK, "fail to translate vaddr = " FMT_WORD
+          " at pc = " FMT_WORD, addr, cpu.pc);
+      ppage = ret & ~(paddr_t)PAGE_MASK;
+      break;
+    }
+    default: panic("invalid access to vaddr = " FMT_WORD " at pc = " FMT_WORD, addr, cpu.pc);
+  }
+
+  TLBEntry *e = &tlb[TLB_IDX(addr)];
+  if (e->vpage != vpage || e->ppage != ppage) {
+    // the entry is taken by another page
+    e->tag[MEM_TYPE_IFETCH] = e->tag[MEM_TYPE_READ] = e->tag[MEM_TYPE_WRITE] = TLB_INVALID;
+    e->vpage = vpage;
+    e->ppage = ppage;
+  }
+  // pages outside pmem are only accessed directly if they are RAM, ROM
+  // or plain memory of a device, and stores to pages with cached
+  // instructions should invalidate the caches
+  uint8_t *host = (in_pmem(ppage) ? guest_to_host(ppage) :
+      pma_direct_page(ppage | (addr & PAGE_MASK), type));
+  bool slow = (host == NULL) || (type == MEM_TYPE_WRITE && paddr_is_protected(ppage));
+#ifdef CONFIG_PMEM_DIRTY
+  // the page is regarded as dirty once it is allowed to be written directly
+  if (type == MEM_TYPE_WRITE && !slow && in_pmem(ppage)) pmem_set_dirty(ppage);
+#endif
+  if (host != NULL) e->addend = (uintptr_t)host - vpage;
+  e->tag[type] = vpage | (slow ? TLB_SLOW : 0);
+}
+
+static word_t tlb_read_slow(vaddr_t addr, int len, int type) {
+  if (!in_page(addr, len)) {
+    // split the access across pages into bytes
+    word_t data = 0;
+    for (int i = 0; i < len; i ++) {
+      data |= tlb_read_slow(addr + i, 1, type) << (i * 8);
+    }
+    return data;
+  }
+  TLBEntry *e = &tlb[TLB_IDX(addr)];
+  vaddr_t vpage = addr & ~PAGE_MASK;
+  if ((e->tag[type] & ~TLB_SLOW) != vpage) tlb_fill(addr, len, type);
+  if (e->tag[type] == vpage) return host_read((void *)(e->addend + addr), len);
+  return paddr_read(e->ppage | (addr & PAGE_MASK), len);
+}
+
+static void tlb_write_slow(vaddr_t addr, int len, word_t data) {
+  if (!in_page(addr, len)) {
+    for (int i = 0; i < len; i ++) {
+      tlb_write_slow(addr + i, 1, data >> (i * 8));
+    }
+    return;
+  }
+  TLBEntry *e = &tlb[TLB_IDX(addr)];
+  vaddr_t vpage = addr & ~PAGE_MASK;
+  if ((e->tag[MEM_TYPE_WRITE] & ~TLB_SLOW) != vpage) tlb_fill(addr, len, MEM_TYPE_WRITE);
+  if (e->tag[MEM_TYPE_WRITE] == vpage) host_write((void *)(e->addend + addr), len, data);
+  else paddr_write(e->ppage | (addr & PAGE_MASK), len, data);
+}
+
+static inline word_t tlb_read(vaddr_t addr, int len, int type) {
+  TLBEntry *e = &tlb[TLB_IDX(addr)];
+  if (likely(e->tag[type] == (addr & ~PAGE_MASK) && in_page(addr, len))) {
+    return host_read((void *)(e->addend + addr), len);
+  }
+  return tlb_read_slow(addr, len, type);
+}
+
+static inline void tlb_write(vaddr_t addr, int len, word_t data) {
+  TLBEntry *e = &tlb[TLB_IDX(addr)];
+  if (likely(e->tag[MEM_TYPE_WRITE] == (addr & ~PAGE_MASK) && in_page(addr, len))) {
+    host_write((void *)(e->addend + addr), len, data);
+    return;
+  }
+  tlb_write_slow(addr, len, data);
+}
 
+word_t vaddr_ifetch(vaddr_t addr, int len) {
+  return tlb_read(addr, len, MEM_TYPE_IFETCH);
+}
+
+word_t vaddr_read(vaddr_t addr, int len) {
+  return tlb_read(addr, len, MEM_TYPE_READ);
+}
+
+void vaddr_write(vaddr_t addr, int len, word_t data) {
+  tlb_write(addr, len, data);
+}
+
+// the width is a constant in the specialized versions, so that
+// the check of page crossing and host_read() are folded
+#define def_vaddr_access(bits) \
+  word_t concat(vaddr_read, bits)(vaddr_t addr) { \
+    return tlb_read(addr, bits / 8, MEM_TYPE_READ); \
+  } \
+  void concat(vaddr_write, bits)(vaddr_t addr, word_t data) { \
+    tlb_write(addr, bits / 8, data); \
+  }
+#else
 word_t vaddr_ifetch(vaddr_t addr, int len) {
   return paddr_read(addr, len);
 }
@@ -27,3 +170,14 @@ word_t vaddr_read(vaddr_t addr, int len) {
 void vaddr_write(vaddr_t addr, int len, word_t data) {
   paddr_write(addr, len, data);
 }
+
+#define def_vaddr_access(bits) \
+  word_t concat(vaddr_read, bits)(vaddr_t addr) { \
+    return concat(paddr_read, bits)(addr); \
+  } \
+  void concat(vaddr_write, bits)(vaddr_t addr, word_t data) { \
+    concat(paddr_write, bits)(addr, data); \
+  }
+#endif
+
+MAP(MEM_WIDTHS, def_vaddr_access)
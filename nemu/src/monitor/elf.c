@@ -0,0 +1,152 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <memory/paddr.h>
+#include <memory/pma.h>
+#include <elf.h>
+#include <unistd.h>
+
+#ifdef CONFIG_ISA64
+typedef Elf64_Ehdr Ehdr;
+typedef Elf64_Phdr Phdr;
+typedef Elf64_Shdr Shdr;
+typedef Elf64_Sym  Sym;
+#define ELF_CLASS ELFCLASS64
+#define ELF_ST_TYPE ELF64_ST_TYPE
+#else
+typedef Elf32_Ehdr Ehdr;
+typedef Elf32_Phdr Phdr;
+typedef Elf32_Shdr Shdr;
+typedef Elf32_Sym  Sym;
+#define ELF_CLASS ELFCLASS32
+#define ELF_ST_TYPE ELF32_ST_TYPE
+#endif
+
+typedef struct {
+  vaddr_t addr;
+  vaddr_t size;
+  char *name;
+} Symbol;
+
+// functions and objects of the image, sorted by address
+static Symbol *symtab = NULL;
+static int nr_symbol = 0;
+
+static void read_at(int fd, void *buf, size_t size, uint64_t offset) {
+  ssize_t ret = pread(fd, buf, size, offset);
+  Assert(ret == size, "failed to read the ELF file");
+}
+
+static int symbol_cmp(const void *a, const void *b) {
+  vaddr_t x = ((const Symbol *)a)->addr, y = ((const Symbol *)b)->addr;
+  return (x > y) - (x < y);
+}
+
+static void load_symbols(int fd, Ehdr *eh) {
+  if (eh->e_shoff == 0) return;
+  Shdr *sh = malloc(sizeof(Shdr) * eh->e_shnum);
+  assert(sh);
+  read_at(fd, sh, sizeof(Shdr) * eh->e_shnum, eh->e_shoff);
+
+  for (int i = 0; i < eh->e_shnum; i ++) {
+    if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum) continue;
+    Shdr *strsh = &sh[sh[i].sh_link];
+    char *strtab = malloc(strsh->sh_size);
+    Sym *sym = malloc(sh[i].sh_size);
+    assert(strtab && sym);
+    read_at(fd, strtab, strsh->sh_size, strsh->sh_offset);
+    read_at(fd, sym, sh[i].sh_size, sh[i].sh_offset);
+
+    int n = sh[i].sh_size / sizeof(Sym);
+    symtab = realloc(symtab, sizeof(Symbol) * (nr_symbol + n));
+    assert(symtab);
+    for (int j = 0; j < n; j ++) {
+      int type = ELF_ST_TYPE(sym[j].st_info);
+      if ((type != STT_FUNC && type != STT_OBJECT) || sym[j].st_name >= strsh->sh_size) continue;
+      symtab[nr_symbol ++] = (Symbol){ .addr = sym[j].st_value, .size = sym[j].st_size,
+        .name = strdup(strtab + sym[j].st_name) };
+    }
+    free(sym);
+    free(strtab);
+  }
+  free(sh);
+  qsort(symtab, nr_symbol, sizeof(Symbol), symbol_cmp);
+}
+
+// Return the name of the symbol containing `addr`, and set `offset` to
+// the offset of `addr` in it. Return NULL if there is no such symbol.
+const char* symbol_lookup(vaddr_t addr, vaddr_t *offset) {
+  int l = 0, r = nr_symbol - 1, found = -1;
+  while (l <= r) {
+    int mid = l + (r - l) / 2;
+    if (symtab[mid].addr <= addr) { found = mid; l = mid + 1; }
+    else r = mid - 1;
+  }
+  if (found == -1) return NULL;
+  Symbol *s = &symtab[found];
+  if (addr - s->addr >= (s->size == 0 ? 1 : s->size)) return NULL;
+  if (offset != NULL) *offset = addr - s->addr;
+  return s->name;
+}
+
+// Load a segment, and fill zero up to `memsz`. Segments in pmem are mapped
+// lazily if possible, and others are loaded through the PMA table, e.g. to
+// the RAM banks of the board. Return whether the segment is in pmem.
+static bool load_segment(int fd, paddr_t addr, uint64_t offset, size_t filesz, size_t memsz) {
+  if (in_pmem(addr) && memsz - 1 <= PMEM_RIGHT - addr) {
+    pmem_load_file(addr, fd, offset, filesz);
+    pmem_zero(addr + filesz, memsz - filesz);
+    return true;
+  }
+  pma_load_file(addr, fd, offset, filesz);
+  pma_load_file(addr + filesz, -1, 0, memsz - filesz);
+  return false;
+}
+
+// Load the PT_LOAD segments of an ELF file to their physical addresses,
+// set the PC to the entry, and keep the symbol table. Return the size of
+// memory from RESET_VECTOR to the end of the segments in pmem, or -1 if
+// the file is not an ELF file.
+long load_elf(const char *file, int fd) {
+  Ehdr eh;
+  if (pread(fd, &eh, sizeof(eh), 0) != sizeof(eh) || memcmp(eh.e_ident, ELFMAG, SELFMAG) != 0) {
+    return -1;
+  }
+  Assert(eh.e_ident[EI_CLASS] == ELF_CLASS && eh.e_ident[EI_DATA] == ELFDATA2LSB,
+      "the class of '%s' does not match the ISA", file);
+  Assert(eh.e_phentsize == sizeof(Phdr), "invalid program headers in '%s'", file);
+
+  Phdr *ph = malloc(sizeof(Phdr) * eh.e_phnum);
+  assert(ph);
+  read_at(fd, ph, sizeof(Phdr) * eh.e_phnum, eh.e_phoff);
+
+  paddr_t end = RESET_VECTOR;
+  for (int i = 0; i < eh.e_phnum; i ++) {
+    if (ph[i].p_type != PT_LOAD || ph[i].p_memsz == 0) continue;
+    paddr_t addr = ph[i].p_paddr;
+    Log("Load segment [" FMT_PADDR ", " FMT_PADDR "), file size = 0x%lx", addr,
+        (paddr_t)(addr + ph[i].p_memsz), (unsigned long)ph[i].p_filesz);
+    Assert(ph[i].p_filesz <= ph[i].p_memsz, "invalid segment in '%s'", file);
+    bool is_pmem = load_segment(fd, addr, ph[i].p_offset, ph[i].p_filesz, ph[i].p_memsz);
+    if (is_pmem && addr + ph[i].p_memsz > end) end = addr + ph[i].p_memsz;
+  }
+  free(ph);
+
+  if (eh.e_shentsize == sizeof(Shdr)) load_symbols(fd, &eh);
+  cpu.pc = eh.e_entry;
+  Log("The image is %s, entry = " FMT_WORD ", %d symbols", file, cpu.pc, nr_symbol);
+  return end - RESET_VECTOR;
+}
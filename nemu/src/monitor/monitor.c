@@ -19,6 +19,7 @@
 void init_rand();
 void init_log(const char *log_file);
 void init_mem();
+void init_board(const char *file);
 void init_difftest(char *ref_so_file, long img_size, int port);
 void init_device();
 void init_sdb();
@@ -38,10 +39,12 @@ static void welcome() {
 #include <getopt.h>
 
 void sdb_set_batch_mode();
+long load_elf(const char *file, int fd);
 
 static char *log_file = NULL;
 static char *diff_so_file = NULL;
 static char *img_file = NULL;
+static char *board_file = CONFIG_PMA_BOARD;
 static int difftest_port = 1234;
 
 static long load_img() {
@@ -53,14 +56,18 @@ static long load_img() {
   FILE *fp = fopen(img_file, "rb");
   Assert(fp, "Can not open '%s'", img_file);
 
+  long size = load_elf(img_file, fileno(fp));
+  if (size >= 0) {
+    fclose(fp);
+    return size;
+  }
+
   fseek(fp, 0, SEEK_END);
-  long size = ftell(fp);
+  size = ftell(fp);
 
   Log("The image is %s, size = %ld", img_file, size);
 
-  fseek(fp, 0, SEEK_SET);
-  int ret = fread(guest_to_host(RESET_VECTOR), size, 1, fp);
-  assert(ret == 1);
+  pmem_load_file(RESET_VECTOR, fileno(fp), 0, size);
 
   fclose(fp);
   return size;
@@ -72,16 +79,18 @@ static int parse_args(int argc, char *argv[]) {
     {"log"      , required_argument, NULL, 'l'},
     {"diff"     , required_argument, NULL, 'd'},
     {"port"     , required_argument, NULL, 'p'},
+    {"board"    , required_argument, NULL, 'B'},
     {"help"     , no_argument      , NULL, 'h'},
     {0          , 0                , NULL,  0 },
   };
   int o;
-  while ( (o = getopt_long(argc, argv, "-bhl:d:p:", table, NULL)) != -1) {
+  while ( (o = getopt_long(argc, argv, "-bhl:d:p:B:", table, NULL)) != -1) {
     switch (o) {
       case 'b': sdb_set_batch_mode(); break;
       case 'p': sscanf(optarg, "%d", &difftest_port); break;
       case 'l': log_file = optarg; break;
       case 'd': diff_so_file = optarg; break;
+      case 'B': board_file = optarg; break;
       case 1: img_file = optarg; return 0;
       default:
         printf("Usage: %s [OPTION...] IMAGE [args]\n\n", argv[0]);
@@ -89,6 +98,7 @@ static int parse_args(int argc, char *argv[]) {
         printf("\t-l,--log=FILE           output log to FILE\n");
         printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
         printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
+        printf("\t-B,--board=FILE         add the memory regions described in FILE\n");
         printf("\n");
         exit(0);
     }
@@ -111,6 +121,9 @@ void init_monitor(int argc, char *argv[]) {
   /* Initialize memory. */
   init_mem();
 
+  /* Add the memory regions of the board. */
+  init_board(board_file);
+
   /* Initialize devices. */
   IFDEF(CONFIG_DEVICE, init_device());
 
@@ -16,6 +16,7 @@
 #include "sdb.h"
 #include <../include/memory/paddr.h>
 #include <cpu/cpu.h>
+#include <cpu/difftest.h>
 #include <isa.h>
 #include <readline/history.h>
 #include <readline/readline.h>
@@ -160,6 +161,16 @@ static int cmd_d(char *args) {
   return 0;
 }
 
+static int cmd_detach(char *args) {
+  difftest_detach();
+  return 0;
+}
+
+static int cmd_attach(char *args) {
+  difftest_attach();
+  return 0;
+}
+
 static int cmd_help(char *args);
 
 static struct {
@@ -179,6 +190,8 @@ static struct {
     [6] = {"p", "calculate the value of the expression", cmd_p},
     [7] = {"w", "set a watchpoint", cmd_w},
     [8] = {"d", "delete a watchpoint", cmd_d},
+    [9] = {"detach", "stop checking with the reference design", cmd_detach},
+    [10] = {"attach", "synchronize the reference design and check again", cmd_attach},
 };
 
 #define NR_CMD ARRLEN(cmd_table)
@@ -251,11 +264,16 @@ void sdb_mainloop() {
   }
 }
 
+// Check expr() with the input generated by tools/gen-expr, if there is one.
 void test_expr() {
-  FILE *fp = fopen(
-      "/home/sherry/Desktop/ysyx-workbench/nemu/tools/gen-expr/input", "r");
-  if (fp == NULL)
-    perror("test_expr error");
+  const char *home = getenv("NEMU_HOME");
+  char file[512];
+  snprintf(file, sizeof(file), "%s/tools/gen-expr/input", (home ? home : "."));
+  FILE *fp = fopen(file, "r");
+  if (fp == NULL) {
+    Log("%s is not found, skip the test of expressions", file);
+    return;
+  }
 
   char *e = NULL;
   uint32_t correct_res;
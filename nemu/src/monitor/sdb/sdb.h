@@ -33,5 +33,6 @@ WP* new_wp();
 void free_wp(int);
 void wp_show();
 void check_watchpoint();
+bool wp_exist();
 
 #endif
@@ -88,6 +88,8 @@ void wp_show(){
   return;
 }
 
+bool wp_exist() { return head != NULL; }
+
 //检查监视点的值是否改变
 void check_watchpoint(){
 	WP* wp = head;
@@ -22,3 +22,9 @@ src/utils/disasm.c: $(LIBCAPSTONE)
 $(LIBCAPSTONE):
 	$(MAKE) -C tools/capstone
 endif
+
+ifdef CONFIG_TARGET_AM
+SRCS-BLACKLIST-y += src/utils/writer.c
+else
+LIBS += -lpthread
+endif
@@ -44,6 +44,16 @@ uint64_t get_time() {
   return now - boot_time;
 }
 
+// time seen by the guest, unit: us
+uint64_t get_guest_time() {
+#ifdef CONFIG_ICOUNT
+  extern uint64_t g_nr_guest_inst;
+  return g_nr_guest_inst / CONFIG_ICOUNT_MIPS;
+#else
+  return get_time();
+#endif
+}
+
 void init_rand() {
-  srand(get_time_internal());
+  srand(MUXDEF(CONFIG_ICOUNT, 0, get_time_internal()));
 }
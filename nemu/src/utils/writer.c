@@ -0,0 +1,107 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <utils.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+// A ring of slots between the emulation thread, which fills them, and
+// the writer thread, which passes them to the handler. The free slots
+// are counted by a semaphore, so that the emulation thread can either
+// give up or wait if the ring is full.
+struct AsyncWriter {
+  FILE *fp;
+  writer_handler_t handler;
+  void *arg;
+  int nr_slot;
+  size_t slot_size;
+  uint8_t *slots;
+  size_t *len;
+  _Atomic uint64_t head;  // the next slot to fill, only written by the producer
+  _Atomic uint64_t tail;  // the next slot to write, only written by the writer
+  _Atomic bool closing;
+  sem_t ready, free;
+  pthread_t thread;
+};
+
+static inline void* slot(AsyncWriter *w, uint64_t i) {
+  return w->slots + (i % w->nr_slot) * w->slot_size;
+}
+
+static void* writer_thread(void *arg) {
+  AsyncWriter *w = arg;
+  while (true) {
+    sem_wait(&w->ready);
+    uint64_t tail = atomic_load_explicit(&w->tail, memory_order_relaxed);
+    if (tail == atomic_load_explicit(&w->head, memory_order_acquire)) {
+      if (atomic_load(&w->closing)) break;
+      continue;
+    }
+    w->handler(w->fp, slot(w, tail), w->len[tail % w->nr_slot], w->arg);
+    atomic_store_explicit(&w->tail, tail + 1, memory_order_release);
+    sem_post(&w->free);
+  }
+  return NULL;
+}
+
+AsyncWriter* writer_open(FILE *fp, int nr_slot, size_t slot_size,
+    writer_handler_t handler, void *arg) {
+  AsyncWriter *w = calloc(1, sizeof(AsyncWriter));
+  assert(w);
+  *w = (AsyncWriter){ .fp = fp, .handler = handler, .arg = arg,
+    .nr_slot = nr_slot, .slot_size = slot_size };
+  w->slots = malloc(nr_slot * slot_size);
+  w->len = calloc(nr_slot, sizeof(size_t));
+  assert(w->slots && w->len);
+  int ret = sem_init(&w->ready, 0, 0);
+  assert(ret == 0);
+  ret = sem_init(&w->free, 0, nr_slot);
+  assert(ret == 0);
+  ret = pthread_create(&w->thread, NULL, writer_thread, w);
+  assert(ret == 0);
+  return w;
+}
+
+// An acquired slot must be committed before the next one is acquired.
+void* writer_acquire(AsyncWriter *w) {
+  if (sem_trywait(&w->free) != 0) return NULL;
+  return slot(w, atomic_load_explicit(&w->head, memory_order_relaxed));
+}
+
+void* writer_acquire_wait(AsyncWriter *w) {
+  while (sem_wait(&w->free) != 0);
+  return slot(w, atomic_load_explicit(&w->head, memory_order_relaxed));
+}
+
+void writer_commit(AsyncWriter *w, size_t len) {
+  uint64_t head = atomic_load_explicit(&w->head, memory_order_relaxed);
+  w->len[head % w->nr_slot] = len;
+  atomic_store_explicit(&w->head, head + 1, memory_order_release);
+  sem_post(&w->ready);
+}
+
+// Wait until all committed slots are written. The file is left open.
+void writer_close(AsyncWriter *w) {
+  atomic_store(&w->closing, true);
+  sem_post(&w->ready);
+  pthread_join(w->thread, NULL);
+  fflush(w->fp);
+  sem_destroy(&w->ready);
+  sem_destroy(&w->free);
+  free(w->slots);
+  free(w->len);
+  free(w);
+}
@@ -0,0 +1,83 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+// Generate a riscv32 benchmark image which only uses the instructions
+// implemented in src/isa/riscv32/inst.c: auipc, lbu, sb and ebreak.
+// There is no branch, so the image is straight-line code and every
+// instruction is executed exactly once. It measures the cost of the
+// first execution of an instruction, including decoding, rather than
+// the dispatch of cached instructions.
+//
+// Usage: gen-bench [nr_group] [nr_store]
+// Each group is an auipc, an lbu and `nr_store` sb to consecutive bytes.
+// A large `nr_store` gives a store-heavy image, e.g. to measure the cost
+// of tracking dirty pages.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#define T0 5
+#define T1 6
+#define PAGE_SIZE 4096
+
+static uint32_t auipc(int rd, uint32_t imm20) { return (imm20 << 12) | (rd << 7) | 0x17; }
+static uint32_t lbu(int rd, int rs1, int imm) {
+  return ((imm & 0xfff) << 20) | (rs1 << 15) | (4 << 12) | (rd << 7) | 0x03;
+}
+static uint32_t sb(int rs1, int rs2, int imm) {
+  return (((imm >> 5) & 0x7f) << 25) | (rs2 << 20) | (rs1 << 15) | ((imm & 0x1f) << 7) | 0x23;
+}
+
+static void emit(uint32_t inst) {
+  size_t ret = fwrite(&inst, sizeof(inst), 1, stdout);
+  assert(ret == 1);
+}
+
+int main(int argc, char *argv[]) {
+  // the number of groups, 16 MiB of code by default
+  long nr_group = 1398101;
+  int nr_store = 1;
+  if (argc > 1) {
+    sscanf(argv[1], "%ld", &nr_group);
+  }
+  if (argc > 2) {
+    sscanf(argv[2], "%d", &nr_store);
+  }
+  assert(nr_group > 0);
+  // the offsets of the stores should fit in the 12-bit immediate
+  assert(nr_store > 0 && nr_store < 2048);
+
+  // the data area starts at the page after the code, and is addressed
+  // relative to the pc, so that sb never modifies the code
+  long nr_inst = nr_group * (nr_store + 2) + 1;
+  long code_size = nr_inst * 4;
+  uint32_t dist = code_size / PAGE_SIZE + 1;
+  long i;
+  int j;
+  for (i = 0; i < nr_group; i ++) {
+    int off = i % (2048 - nr_store);
+    emit(auipc(T0, dist));
+    emit(lbu(T1, T0, off));
+    for (j = 1; j <= nr_store; j ++) {
+      emit(sb(T0, T1, off + j));
+    }
+  }
+  // a0 is never written, so this is a good trap
+  emit(0x00100073); // ebreak
+  fprintf(stderr, "%ld instructions, %ld bytes\n", nr_inst, code_size);
+  return 0;
+}
@@ -0,0 +1,255 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Generate a decode tree from the INSTPAT table of an ISA.
+ *
+ * Usage: gen-decode inst.c hi:lo [hi:lo ...]
+ *
+ * Every `INSTPAT("pattern", name, type, ...)` found in inst.c is collected in
+ * order. The instruction fields given by hi:lo are used as the keys of nested
+ * switch statements. Each leaf only contains the patterns which are compatible
+ * with the values of the keys, in their original order, so the semantics of
+ * "the first matched pattern wins" is kept. The output is meant to be included
+ * between INSTPAT_START() and INSTPAT_END().
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#define MAX_PAT 1024
+#define MAX_FIELD 8
+#define MAX_FIELD_BITS 10
+
+typedef struct {
+  char pattern[128];
+  char name[64];
+  char type[16];
+  uint64_t key, mask;
+} Pattern;
+
+static Pattern pats[MAX_PAT];
+static int nr_pat = 0;
+
+static struct {
+  int hi, lo;
+} fields[MAX_FIELD];
+static int nr_field = 0;
+
+static void fail(const char *msg, const char *arg) {
+  fprintf(stderr, "gen-decode: %s%s\n", msg, arg);
+  exit(1);
+}
+
+static const char* skip_space(const char *p) {
+  while (isspace((unsigned char)*p)) p ++;
+  return p;
+}
+
+static const char* read_ident(const char *p, char *buf, int size) {
+  int n = 0;
+  p = skip_space(p);
+  while (isalnum((unsigned char)*p) || *p == '_' || *p == '.') {
+    if (n < size - 1) buf[n ++] = *p;
+    p ++;
+  }
+  buf[n] = '\0';
+  return skip_space(p);
+}
+
+static void parse_pattern(Pattern *pat) {
+  int len = 0;
+  for (const char *c = pat->pattern; *c; c ++) {
+    if (*c == ' ') continue;
+    if (*c != '0' && *c != '1' && *c != '?') fail("invalid pattern ", pat->pattern);
+    len ++;
+  }
+  if (len > 64) fail("pattern too long: ", pat->pattern);
+
+  int bit = len - 1;
+  pat->key = pat->mask = 0;
+  for (const char *c = pat->pattern; *c; c ++) {
+    if (*c == ' ') continue;
+    if (*c != '?') {
+      pat->mask |= 1ull << bit;
+      if (*c == '1') pat->key |= 1ull << bit;
+    }
+    bit --;
+  }
+}
+
+static void load(const char *file) {
+  FILE *fp = fopen(file, "r");
+  if (fp == NULL) fail("can not open ", file);
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  char *src = malloc(size + 1);
+  assert(src);
+  int ret = fread(src, size, 1, fp);
+  assert(ret == 1 || size == 0);
+  src[size] = '\0';
+  fclose(fp);
+
+  for (const char *p = src; (p = strstr(p, "INSTPAT(")) != NULL; ) {
+    p = skip_space(p + strlen("INSTPAT("));
+    // skip macro definitions such as INSTPAT(__VA_ARGS__)
+    if (*p != '"') continue;
+    if (nr_pat == MAX_PAT) fail("too many patterns in ", file);
+
+    Pattern *pat = &pats[nr_pat ++];
+    const char *end = strchr(p + 1, '"');
+    if (end == NULL || end - p - 1 >= sizeof(pat->pattern)) fail("bad pattern in ", file);
+    memcpy(pat->pattern, p + 1, end - p - 1);
+    pat->pattern[end - p - 1] = '\0';
+    parse_pattern(pat);
+
+    p = skip_space(end + 1);
+    if (*p != ',') fail("missing name for ", pat->pattern);
+    p = read_ident(p + 1, pat->name, sizeof(pat->name));
+    if (*p != ',') fail("missing type for ", pat->pattern);
+    p = read_ident(p + 1, pat->type, sizeof(pat->type));
+  }
+  free(src);
+
+  if (nr_pat == 0) fail("no INSTPAT is found in ", file);
+}
+
+static uint64_t field_mask(int f) {
+  int w = fields[f].hi - fields[f].lo + 1;
+  return ((1ull << w) - 1) << fields[f].lo;
+}
+
+static bool compatible(Pattern *pat, int f, uint64_t val) {
+  uint64_t m = pat->mask & field_mask(f);
+  return ((val << fields[f].lo) & m) == (pat->key & m);
+}
+
+static void indent(int n) {
+  printf("%*s", n * 2, "");
+}
+
+static void emit_leaf(int *cand, int nr, uint64_t known, int depth) {
+  for (int i = 0; i < nr; i ++) {
+    Pattern *pat = &pats[cand[i]];
+    indent(depth);
+    printf("INSTPAT(\"%s\", %s, %s);\n", pat->pattern, pat->name, pat->type);
+    // all fixed bits of this pattern are checked by the switches, so it
+    // always matches and the remaining candidates are unreachable
+    if ((pat->mask & ~known) == 0) break;
+  }
+}
+
+static void emit(int *cand, int nr, int f, uint64_t known, int depth) {
+  if (f == nr_field || nr <= 1) {
+    emit_leaf(cand, nr, known, depth);
+    return;
+  }
+
+  int nr_val = 1 << (fields[f].hi - fields[f].lo + 1);
+  int (*sub)[MAX_PAT] = malloc(sizeof(*sub) * nr_val);
+  int *nr_sub = calloc(nr_val, sizeof(int));
+  int *group = malloc(sizeof(int) * nr_val);
+  int *group_size = calloc(nr_val, sizeof(int));
+  assert(sub && nr_sub && group && group_size);
+
+  for (int v = 0; v < nr_val; v ++) {
+    for (int i = 0; i < nr; i ++) {
+      if (compatible(&pats[cand[i]], f, v)) sub[v][nr_sub[v] ++] = cand[i];
+    }
+  }
+
+  // values with the same candidates share the same case
+  int def = 0;
+  for (int v = 0; v < nr_val; v ++) {
+    group[v] = v;
+    for (int u = 0; u < v; u ++) {
+      if (group[u] == u && nr_sub[u] == nr_sub[v] &&
+          memcmp(sub[u], sub[v], sizeof(int) * nr_sub[v]) == 0) {
+        group[v] = u;
+        break;
+      }
+    }
+    group_size[group[v]] ++;
+    if (group_size[group[v]] > group_size[def]) def = group[v];
+  }
+
+  if (group_size[def] == nr_val) {
+    // this field does not distinguish the candidates
+    emit(sub[def], nr_sub[def], f + 1, known, depth);
+  } else {
+    indent(depth);
+    printf("switch (BITS(INSTPAT_INST(s), %d, %d)) {\n", fields[f].hi, fields[f].lo);
+    for (int v = 0; v < nr_val; v ++) {
+      if (group[v] != v || v == def) continue;
+      indent(depth + 1);
+      const char *sep = "";
+      for (int u = v; u < nr_val; u ++) {
+        if (group[u] == v) { printf("%scase 0x%x:", sep, u); sep = " "; }
+      }
+      printf("\n");
+      emit(sub[v], nr_sub[v], f + 1, known | field_mask(f), depth + 2);
+      indent(depth + 2);
+      printf("break;\n");
+    }
+    indent(depth + 1);
+    printf("default:\n");
+    emit(sub[def], nr_sub[def], f + 1, known | field_mask(f), depth + 2);
+    indent(depth + 2);
+    printf("break;\n");
+    indent(depth);
+    printf("}\n");
+  }
+
+  free(sub);
+  free(nr_sub);
+  free(group);
+  free(group_size);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s inst.c hi:lo [hi:lo ...]\n", argv[0]);
+    return 1;
+  }
+
+  for (int i = 2; i < argc; i ++) {
+    if (nr_field == MAX_FIELD) fail("too many fields", "");
+    int hi, lo;
+    if (sscanf(argv[i], "%d:%d", &hi, &lo) != 2 || hi < lo || lo < 0 ||
+        hi - lo + 1 > MAX_FIELD_BITS) {
+      fail("invalid field ", argv[i]);
+    }
+    fields[nr_field].hi = hi;
+    fields[nr_field].lo = lo;
+    nr_field ++;
+  }
+
+  load(argv[1]);
+
+  int *cand = malloc(sizeof(int) * nr_pat);
+  assert(cand);
+  for (int i = 0; i < nr_pat; i ++) cand[i] = i;
+
+  printf("// Generated by tools/gen-decode from %s. DO NOT EDIT.\n", argv[1]);
+  emit(cand, nr_pat, 0, 0, 1);
+
+  free(cand);
+  return 0;
+}